@@ -0,0 +1,772 @@
+// feeds a corpus of frame sequences through the driver and the protocol code
+// and reports what each update costs, as CSV or JSON, for comparing driver
+// and protocol changes.
+//
+// the corpus is generated from fixed seeds, so everything but
+// host_rows_per_s comes out the same on every run of the same build.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "eink.h"
+#include "chunk.h"
+#include "client.h"
+#include "dirty.h"
+#include "frame.h"
+#include "hal_mock.h"
+#include "perf.h"
+#include "protocol.h"
+#include "rle.h"
+#include "shadow.h"
+
+
+#define MAX_FRAMES 10
+
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline int min_int(int a, int b) { return a < b ? a : b; }
+
+
+// xorshift32, so the corpus doesn't depend on the C library's rand()
+static uint32_t rng_state;
+
+static void rng_seed(uint32_t seed)
+{
+    rng_state = seed ? seed : 1;
+}
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static int rng_range(int n)
+{
+    return rng_next() % n;
+}
+
+static uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+
+static void fill_rect(struct frame *f, int x, int y, int w, int h, pixel_t p)
+{
+    const int x1 = min_int(x + w, f->w);
+    const int y1 = min_int(y + h, f->h);
+    for (int py = y; py < y1; ++py) {
+        for (int px = x; px < x1; ++px) {
+            set_row_pixel(frame_row(f, py), px, p);
+        }
+    }
+}
+
+static void copy_frame(struct frame *dst, const struct frame *src)
+{
+    memcpy(dst->bits, src->bits, (size_t)src->h * src->stride);
+}
+
+
+// glyphs are 5x7 pixels in a GLYPH_W x LINE_H cell, made up from a hash of
+// the character, so a page has the texture of text without needing a font
+#define GLYPH_W 6
+#define LINE_H 12
+
+static void draw_glyph(struct frame *f, int x, int y, int c, int scale)
+{
+    const uint64_t bits = ((uint64_t)hash32(c) << 32) | hash32(c + 0x100);
+    for (int gy = 0; gy < 7; ++gy) {
+        for (int gx = 0; gx < 5; ++gx) {
+            if ((bits >> (gy * 5 + gx)) & 1) {
+                fill_rect(f, x + gx * scale, y + gy * scale, scale, scale,
+                    BLACK);
+            }
+        }
+    }
+}
+
+// fills x0..x1, y0..y1 with lines of random words, in paragraphs
+static void draw_text(struct frame *f, int x0, int y0, int x1, int y1)
+{
+    int x = x0;
+    int y = y0;
+    int lines_left = 3 + rng_range(8);
+
+    while (y + LINE_H <= y1) {
+        const int word_len = 1 + rng_range(9);
+        if (x + word_len * GLYPH_W > x1) {
+            x = x0;
+            y += LINE_H;
+            if (0 == --lines_left) {
+                y += LINE_H;
+                lines_left = 3 + rng_range(8);
+            }
+            continue;
+        }
+
+        for (int i = 0; i < word_len; ++i) {
+            draw_glyph(f, x + i * GLYPH_W, y, 'a' + rng_range(26), 1);
+        }
+        x += (word_len + 1) * GLYPH_W;
+    }
+}
+
+
+// smooth random greys: value noise at two scales, bilinearly interpolated
+#define NOISE_CELL 64
+
+static int noise_at(uint32_t seed, int cell, int x, int y)
+{
+    const int cx = x / cell;
+    const int cy = y / cell;
+    const int fx = x % cell;
+    const int fy = y % cell;
+
+    int v[4];
+    for (int i = 0; i < 4; ++i) {
+        const uint32_t h = hash32(seed ^ hash32((cx + (i & 1)) * 73856093
+            ^ (cy + (i >> 1)) * 19349663));
+        v[i] = h & 0xff;
+    }
+
+    const int top = v[0] * (cell - fx) + v[1] * fx;
+    const int bottom = v[2] * (cell - fx) + v[3] * fx;
+    return (top * (cell - fy) + bottom * fy) / (cell * cell);
+}
+
+static const uint8_t bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+// a photo-like image, ordered dithered to the build's grey levels
+static void draw_photo(struct frame *f, uint32_t seed)
+{
+    for (int y = 0; y < f->h; ++y) {
+        for (int x = 0; x < f->w; ++x) {
+            // how dark, 0..255
+            const int g = (3 * noise_at(seed, NOISE_CELL, x, y)
+                + noise_at(seed + 1, NOISE_CELL / 4, x, y)) / 4;
+            int level = (g * (NUM_GREY_LEVELS - 1) * 64
+                + bayer8[y % 8][x % 8] * 255 + 127) / (255 * 64);
+            if (level > NUM_GREY_LEVELS - 1) {
+                level = NUM_GREY_LEVELS - 1;
+            }
+            set_row_pixel(frame_row(f, y), x, level);
+        }
+    }
+}
+
+
+// the corpus: sequences of frames, each drawn over the one before
+struct scenario {
+    char name[64];
+    int num_frames;
+    struct frame frames[MAX_FRAMES];
+};
+
+static bool alloc_frames(struct scenario *s, int num_frames)
+{
+    s->num_frames = num_frames;
+    for (int i = 0; i < num_frames; ++i) {
+        if (!frame_alloc(&s->frames[i], SCREEN_BITMAP_WIDTH,
+            SCREEN_BITMAP_HEIGHT))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void free_frames(struct scenario *s)
+{
+    for (int i = 0; i < s->num_frames; ++i) {
+        frame_free(&s->frames[i]);
+    }
+}
+
+// whole pages of text, as when turning pages of a book
+static bool make_text(struct scenario *s)
+{
+    snprintf(s->name, sizeof(s->name), "text");
+    if (!alloc_frames(s, 3)) {
+        return false;
+    }
+
+    rng_seed(1);
+    for (int i = 0; i < s->num_frames; ++i) {
+        draw_text(&s->frames[i], 40, 30, SCREEN_BITMAP_WIDTH - 40,
+            SCREEN_BITMAP_HEIGHT - 30);
+    }
+    return true;
+}
+
+// a grid of panels, each with a label and a four digit value. every update
+// changes two of the values.
+#define DASH_COLS 4
+#define DASH_ROWS 3
+#define DASH_PANEL_W (SCREEN_BITMAP_WIDTH / DASH_COLS)
+#define DASH_PANEL_H (SCREEN_BITMAP_HEIGHT / DASH_ROWS)
+#define DASH_DIGIT_SCALE 4
+
+static void draw_dash_value(struct frame *f, int panel)
+{
+    const int x = (panel % DASH_COLS) * DASH_PANEL_W + 30;
+    const int y = (panel / DASH_COLS) * DASH_PANEL_H + 80;
+
+    fill_rect(f, x, y, 4 * GLYPH_W * DASH_DIGIT_SCALE, 7 * DASH_DIGIT_SCALE,
+        WHITE);
+    for (int i = 0; i < 4; ++i) {
+        draw_glyph(f, x + i * GLYPH_W * DASH_DIGIT_SCALE, y,
+            '0' + rng_range(10), DASH_DIGIT_SCALE);
+    }
+}
+
+static bool make_dashboard(struct scenario *s)
+{
+    snprintf(s->name, sizeof(s->name), "dashboard");
+    if (!alloc_frames(s, 9)) {
+        return false;
+    }
+
+    rng_seed(2);
+    struct frame *f = &s->frames[0];
+    for (int panel = 0; panel < DASH_COLS * DASH_ROWS; ++panel) {
+        const int x = (panel % DASH_COLS) * DASH_PANEL_W;
+        const int y = (panel / DASH_COLS) * DASH_PANEL_H;
+
+        fill_rect(f, x + 8, y + 8, DASH_PANEL_W - 16, 2, BLACK);
+        fill_rect(f, x + 8, y + DASH_PANEL_H - 10, DASH_PANEL_W - 16, 2,
+            BLACK);
+        fill_rect(f, x + 8, y + 8, 2, DASH_PANEL_H - 16, BLACK);
+        fill_rect(f, x + DASH_PANEL_W - 10, y + 8, 2, DASH_PANEL_H - 16,
+            BLACK);
+        draw_text(f, x + 20, y + 20, x + DASH_PANEL_W - 20, y + 20 + LINE_H);
+        draw_dash_value(f, panel);
+    }
+
+    for (int i = 1; i < s->num_frames; ++i) {
+        copy_frame(&s->frames[i], &s->frames[i - 1]);
+        draw_dash_value(&s->frames[i], rng_range(DASH_COLS * DASH_ROWS));
+        draw_dash_value(&s->frames[i], rng_range(DASH_COLS * DASH_ROWS));
+    }
+    return true;
+}
+
+// full screen photos, one after another
+static bool make_photo(struct scenario *s)
+{
+    snprintf(s->name, sizeof(s->name), "photo");
+    if (!alloc_frames(s, 3)) {
+        return false;
+    }
+
+    for (int i = 0; i < s->num_frames; ++i) {
+        draw_photo(&s->frames[i], 1000 * (i + 1));
+    }
+    return true;
+}
+
+// a page of text scrolled up a couple of lines at a time
+#define SCROLL_STEP (2 * LINE_H)
+
+static bool make_scroll(struct scenario *s)
+{
+    snprintf(s->name, sizeof(s->name), "scroll");
+    if (!alloc_frames(s, 6)) {
+        return false;
+    }
+
+    struct frame doc;
+    if (!frame_alloc(&doc, SCREEN_BITMAP_WIDTH,
+        SCREEN_BITMAP_HEIGHT + (s->num_frames - 1) * SCROLL_STEP))
+    {
+        return false;
+    }
+
+    rng_seed(4);
+    draw_text(&doc, 40, 0, SCREEN_BITMAP_WIDTH - 40, doc.h);
+    for (int i = 0; i < s->num_frames; ++i) {
+        memcpy(s->frames[i].bits, frame_row(&doc, i * SCROLL_STEP),
+            (size_t)SCREEN_BITMAP_HEIGHT * doc.stride);
+    }
+
+    frame_free(&doc);
+    return true;
+}
+
+static bool load_pair(struct scenario *s, const char *old_path,
+    const char *new_path)
+{
+    snprintf(s->name, sizeof(s->name), "%s", new_path);
+    s->num_frames = 0;
+    if (!frame_load_pnm(&s->frames[0], old_path)) {
+        return false;
+    }
+    s->num_frames = 1;
+    if (!frame_load_pnm(&s->frames[1], new_path)) {
+        return false;
+    }
+    s->num_frames = 2;
+
+    for (int i = 0; i < s->num_frames; ++i) {
+        if (SCREEN_BITMAP_WIDTH != s->frames[i].w
+            || SCREEN_BITMAP_HEIGHT != s->frames[i].h)
+        {
+            fprintf(stderr, "frames must be %dx%d\n", SCREEN_BITMAP_WIDTH,
+                SCREEN_BITMAP_HEIGHT);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// the ways a client can send an update, and what they cost on the wire
+struct protocol {
+    const char *name;
+    // the tile protocol, which sends the whole screen. otherwise the
+    // rectangles that changed.
+    bool tiles;
+    bool encoded;
+    bool new_only;
+    // PROTO_CMD_FAST or PROTO_CMD_PARTIAL before the command
+    enum EINK_MODE mode;
+};
+
+static const struct protocol protocols[] = {
+    { "tiles", true,  false, false, EINK_MODE_FULL },
+    { "T",     true,  true,  false, EINK_MODE_FULL },
+    { "R",     false, false, false, EINK_MODE_FULL },
+    { "E",     false, true,  false, EINK_MODE_FULL },
+    { "N",     false, false, true,  EINK_MODE_FULL },
+    { "M",     false, true,  true,  EINK_MODE_FULL },
+    { "QM",    false, true,  true,  EINK_MODE_FAST },
+    { "PM",    false, true,  true,  EINK_MODE_PARTIAL },
+};
+
+#define NUM_PROTOCOLS (sizeof(protocols) / sizeof(protocols[0]))
+
+struct result {
+    int updates;
+    // tiles or rectangle bands sent
+    int chunks;
+    // both ways
+    long wire_bytes;
+    uint64_t model_ns;
+    uint32_t spi_words;
+    uint32_t rows;
+    // host time spent in the driver
+    double cpu_s;
+};
+
+
+// the bytes of one chunk, as client_send_rects or a tile protocol client
+// would send them
+static long chunk_wire_bytes(const struct frame *old_frame,
+    const struct frame *new_frame, const struct rect *r,
+    const struct protocol *p)
+{
+    const size_t size = (size_t)r->h * BITMAP_ROW_SIZE(r->w);
+    if (!p->encoded) {
+        return p->new_only ? size : 2 * size;
+    }
+
+    static uint8_t old_buf[CHUNK_BUF_SIZE];
+    static uint8_t new_buf[CHUNK_BUF_SIZE];
+    static uint8_t enc_buf[2 * RLE_MAX_ENCODED_SIZE(CHUNK_BUF_SIZE)];
+    frame_copy_rect(old_frame, r, old_buf);
+    frame_copy_rect(new_frame, r, new_buf);
+
+    struct chunk_header ch;
+    return sizeof(ch) + client_encode_chunk(p->new_only ? NULL : old_buf,
+        new_buf, size, &ch, enc_buf);
+}
+
+// whether p is drawn as tiles or rectangles in mode
+static bool uses_panel(const struct protocol *p, bool tiles,
+    enum EINK_MODE mode)
+{
+    return p->tiles == tiles && p->mode == mode;
+}
+
+// draws a chunk list as the display task does
+static void draw_list(struct chunk_list *cl, enum EINK_MODE mode,
+    struct result *res)
+{
+    const uint32_t rows = perf_hists[PERF_ROW_ENCODE].count;
+    hal_mock_reset_counters();
+
+    const double start = now_s();
+    const bool completed = eink_update_spans(mode,
+        get_rows_from_chunk_list, cl, cl->regions, cl->num_chunks);
+    res->cpu_s += now_s() - start;
+
+    chunk_list_drawn(cl, completed);
+    res->model_ns += hal_mock_counters.model_ns;
+    res->spi_words += hal_mock_counters.spi_words;
+    res->rows += perf_hists[PERF_ROW_ENCODE].count - rows;
+}
+
+// adds r, copied from the frames, to cl in chunk_bufs[0]. returns false if
+// it doesn't fit, as handle_rects decides.
+static bool add_chunk(struct chunk_list *cl, int *size,
+    const struct frame *old_frame, const struct frame *new_frame,
+    const struct rect *r)
+{
+    const int byte_w = BITMAP_ROW_SIZE(r->w);
+    const int chunk_size = r->h * byte_w;
+    if (EINK_MAX_REGIONS == cl->num_chunks
+        || *size + chunk_size > CHUNK_BUF_SIZE)
+    {
+        return false;
+    }
+
+    struct chunk_buf *buf = &chunk_bufs[0];
+    frame_copy_rect(old_frame, r, buf->old_bits + *size);
+    frame_copy_rect(new_frame, r, buf->new_bits + *size);
+
+    const int i = cl->num_chunks++;
+    cl->regions[i] = (struct eink_region){
+        .x0 = SCREEN_BITMAP_X_OFS + r->x,
+        .y0 = SCREEN_BITMAP_Y_OFS + r->y,
+        .x1 = SCREEN_BITMAP_X_OFS + r->x + r->w,
+        .y1 = SCREEN_BITMAP_Y_OFS + r->y + r->h,
+    };
+    cl->chunks[i] = (struct chunk_params){
+        .buf = buf,
+        .has_old = true,
+        .x = cl->regions[i].x0,
+        .y = cl->regions[i].y0,
+        .byte_w = byte_w,
+        .ofs = *size,
+    };
+    *size += chunk_size;
+    return true;
+}
+
+// the same walk over the screen as handle_tiles, one tile per job. the
+// panel's cost goes in *panel, and each protocol's wire cost in results.
+static void update_tiles(const struct frame *old_frame,
+    const struct frame *new_frame, enum EINK_MODE mode, struct result *panel,
+    struct result *results)
+{
+    for (int y = 0; y < SCREEN_BITMAP_HEIGHT; y += CHUNK_HEIGHT - CHUNK_OVERLAP) {
+        for (int x = 0; x < SCREEN_BITMAP_WIDTH; x += CHUNK_WIDTH - CHUNK_OVERLAP) {
+            const struct rect r = {
+                x, y,
+                min_int(SCREEN_BITMAP_WIDTH - x, CHUNK_WIDTH),
+                min_int(SCREEN_BITMAP_HEIGHT - y, CHUNK_HEIGHT),
+            };
+
+            struct chunk_list cl = {};
+            int size = 0;
+            add_chunk(&cl, &size, old_frame, new_frame, &r);
+            draw_list(&cl, mode, panel);
+
+            for (int i = 0; i < NUM_PROTOCOLS; ++i) {
+                if (uses_panel(&protocols[i], true, mode)) {
+                    // the device sends x, y, w, h as int32s
+                    results[i].wire_bytes += 4 * sizeof(int32_t)
+                        + chunk_wire_bytes(old_frame, new_frame, &r,
+                            &protocols[i]);
+                    ++results[i].chunks;
+                }
+            }
+        }
+    }
+}
+
+// the rectangles that changed, split into bands as client_send_rects does
+// and batched into jobs as handle_rects does when the client has sent them
+// all before the first is drawn
+static bool update_rects(const struct frame *old_frame,
+    const struct frame *new_frame, int rect_cost, enum EINK_MODE mode,
+    struct result *panel, struct result *results)
+{
+    int num_rects;
+    struct rect *rects = find_dirty_rects(old_frame, new_frame, rect_cost,
+        &num_rects);
+    if (!rects) {
+        return false;
+    }
+
+    struct chunk_list cl = {};
+    int size = 0;
+    int num_bands = 0;
+
+    for (int i = 0; i < num_rects; ++i) {
+        const struct rect *r = &rects[i];
+        const int band_h = CHUNK_BUF_SIZE / BITMAP_ROW_SIZE(r->w);
+
+        for (int y = 0; y < r->h; y += band_h) {
+            const struct rect band = {
+                r->x, r->y + y, r->w, min_int(r->h - y, band_h),
+            };
+
+            // find_dirty_rects's rectangles don't overlap
+            if (!add_chunk(&cl, &size, old_frame, new_frame, &band)) {
+                draw_list(&cl, mode, panel);
+                cl.num_chunks = 0;
+                size = 0;
+                add_chunk(&cl, &size, old_frame, new_frame, &band);
+            }
+
+            for (int j = 0; j < NUM_PROTOCOLS; ++j) {
+                if (uses_panel(&protocols[j], false, mode)) {
+                    results[j].wire_bytes += sizeof(struct rect_header)
+                        + chunk_wire_bytes(old_frame, new_frame, &band,
+                            &protocols[j]);
+                    ++results[j].chunks;
+                }
+            }
+            ++num_bands;
+        }
+    }
+
+    if (cl.num_chunks > 0) {
+        draw_list(&cl, mode, panel);
+    }
+
+    for (int j = 0; j < NUM_PROTOCOLS; ++j) {
+        if (uses_panel(&protocols[j], false, mode)) {
+            // the list's end and a status byte for each band
+            results[j].wire_bytes += sizeof(struct rect_header) + num_bands;
+        }
+    }
+
+    free(rects);
+    return true;
+}
+
+// the panel shows frame f, as if it had been drawn in full
+static void seed_shadow(const struct frame *f)
+{
+    shadow_fill(WHITE);
+    for (int y = 0; y < f->h; ++y) {
+        shadow_put_span(SCREEN_BITMAP_Y_OFS + y, SCREEN_BITMAP_X_OFS,
+            SCREEN_BITMAP_X_OFS + f->w, frame_row(f, y));
+    }
+}
+
+// runs every update of a scenario over each protocol. the panel side only
+// depends on whether it's tiles or rectangles, and the mode, so it's run
+// once for each of those the protocols use.
+static bool run_scenario(const struct scenario *s, int rect_cost,
+    struct result *results)
+{
+    memset(results, 0, NUM_PROTOCOLS * sizeof(*results));
+
+    for (int run = 0; run < 2 * NUM_EINK_MODES; ++run) {
+        const bool tiles = run / NUM_EINK_MODES;
+        const enum EINK_MODE mode = run % NUM_EINK_MODES;
+
+        bool used = false;
+        for (int j = 0; j < NUM_PROTOCOLS; ++j) {
+            used = used || uses_panel(&protocols[j], tiles, mode);
+        }
+        if (!used) {
+            continue;
+        }
+
+        struct result panel = {};
+        seed_shadow(&s->frames[0]);
+        for (int i = 1; i < s->num_frames; ++i) {
+            if (tiles) {
+                update_tiles(&s->frames[i - 1], &s->frames[i], mode, &panel,
+                    results);
+            } else if (!update_rects(&s->frames[i - 1], &s->frames[i],
+                rect_cost, mode, &panel, results))
+            {
+                return false;
+            }
+        }
+
+        for (int j = 0; j < NUM_PROTOCOLS; ++j) {
+            if (!uses_panel(&protocols[j], tiles, mode)) {
+                continue;
+            }
+
+            struct result *res = &results[j];
+            res->updates = s->num_frames - 1;
+            // the command byte, and the device's struct rects_hello
+            if (!tiles) {
+                res->wire_bytes += res->updates
+                    * (1 + sizeof(struct rects_hello));
+            } else if (protocols[j].encoded) {
+                res->wire_bytes += res->updates;
+            }
+            if (EINK_MODE_FULL != mode) {
+                res->wire_bytes += res->updates;
+            }
+            res->model_ns = panel.model_ns;
+            res->spi_words = panel.spi_words;
+            res->rows = panel.rows;
+            res->cpu_s = panel.cpu_s;
+        }
+    }
+    return true;
+}
+
+
+static bool json_output;
+static bool first_record = true;
+
+static void print_header(void)
+{
+    if (json_output) {
+        printf("[\n");
+    } else {
+        printf("scenario,protocol,pixel_bits,updates,chunks,wire_bytes,"
+            "model_ms,spi_words,rows,host_rows_per_s\n");
+    }
+}
+
+static void print_result(const char *scenario, const struct protocol *p,
+    const struct result *res)
+{
+    const double model_ms = res->model_ns / 1e6;
+    const double rows_per_s = res->cpu_s > 0 ? res->rows / res->cpu_s : 0;
+
+    if (json_output) {
+        printf("%s  {\"scenario\": \"%s\", \"protocol\": \"%s\", "
+            "\"pixel_bits\": %d, \"updates\": %d, \"chunks\": %d, "
+            "\"wire_bytes\": %ld, \"model_ms\": %.3f, \"spi_words\": %u, "
+            "\"rows\": %u, \"host_rows_per_s\": %.0f}",
+            first_record ? "" : ",\n", scenario, p->name, PIXEL_BIT_SIZE,
+            res->updates, res->chunks, res->wire_bytes, model_ms,
+            res->spi_words, res->rows, rows_per_s);
+    } else {
+        printf("%s,%s,%d,%d,%d,%ld,%.3f,%u,%u,%.0f\n", scenario, p->name,
+            PIXEL_BIT_SIZE, res->updates, res->chunks, res->wire_bytes,
+            model_ms, res->spi_words, res->rows, rows_per_s);
+    }
+    first_record = false;
+}
+
+static void print_footer(void)
+{
+    if (json_output) {
+        printf("\n]\n");
+    }
+}
+
+
+static bool bench(struct scenario *s, int rect_cost)
+{
+    struct result results[NUM_PROTOCOLS];
+    const bool ok = run_scenario(s, rect_cost, results);
+    if (ok) {
+        for (int i = 0; i < NUM_PROTOCOLS; ++i) {
+            print_result(s->name, &protocols[i], &results[i]);
+        }
+    }
+    free_frames(s);
+    return ok;
+}
+
+// stands in for the board's temperature sensor. arg is the temperature.
+static bool get_fixed_temp(void *arg, int *temp_c)
+{
+    *temp_c = *(const int *)arg;
+    return true;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: einkbench [-j] [-c rect_cost] [-t temp_c]\n"
+        "                 [old.pnm new.pnm ...]\n"
+        "\n"
+        "draws a corpus of updates with the mock hardware backend and prints\n"
+        "what each protocol costs, as CSV.\n"
+        "  -j  print JSON instead\n"
+        "  -c  cost of a rectangle in bytes when merging (default %d)\n"
+        "  -t  the panel's temperature in degrees C, which picks the\n"
+        "      waveform timings (default unknown, so the coldest)\n"
+        "with frame pairs, benchmarks those instead of the built in corpus.\n",
+        DEFAULT_RECT_COST);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int rect_cost = DEFAULT_RECT_COST;
+    int temp_c;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "jc:t:"))) {
+        switch (opt) {
+        case 'j':
+            json_output = true;
+            break;
+        case 'c':
+            rect_cost = atoi(optarg);
+            break;
+        case 't':
+            temp_c = atoi(optarg);
+            eink_set_temp_source(get_fixed_temp, &temp_c);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (0 != (argc - optind) % 2) {
+        usage();
+    }
+
+    if (!eink_setup()) {
+        fprintf(stderr, "eink setup fail\n");
+        return 1;
+    }
+    eink_power_on();
+
+    print_header();
+
+    static struct scenario s;
+    bool ok = true;
+    if (optind == argc) {
+        bool (*const makers[])(struct scenario *) = {
+            make_text, make_dashboard, make_photo, make_scroll,
+        };
+        for (int i = 0; ok && i < sizeof(makers) / sizeof(makers[0]); ++i) {
+            ok = makers[i](&s) && bench(&s, rect_cost);
+        }
+    } else {
+        for (int i = optind; ok && i < argc; i += 2) {
+            ok = load_pair(&s, argv[i], argv[i + 1]) && bench(&s, rect_cost);
+        }
+    }
+
+    print_footer();
+    eink_power_off();
+
+    if (!ok) {
+        fprintf(stderr, "benchmark failed\n");
+        return 1;
+    }
+    return 0;
+}
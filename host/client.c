@@ -0,0 +1,446 @@
+#include <netdb.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "eink.h"
+#include "crc32.h"
+#include "protocol.h"
+#include "rle.h"
+#include "client.h"
+
+
+int client_connect(const char *addr)
+{
+    char host[256];
+    char port[16];
+    snprintf(port, sizeof(port), "%d", LISTEN_PORT);
+
+    snprintf(host, sizeof(host), "%s", addr);
+    char *colon = strrchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        snprintf(port, sizeof(port), "%s", colon + 1);
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "%s: %s\n", addr, gai_strerror(err));
+        return -1;
+    }
+
+    int sock = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+        if (0 == connect(sock, ai->ai_addr, ai->ai_addrlen)) {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+
+    if (sock < 0) {
+        fprintf(stderr, "%s: can't connect\n", addr);
+    }
+    return sock;
+}
+
+bool client_send_all(int sock, const void *buf, size_t size)
+{
+    const uint8_t *p = buf;
+    while (size > 0) {
+        ssize_t sent = send(sock, p, size, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool client_recv_all(int sock, void *buf, size_t size)
+{
+    uint8_t *p = buf;
+    while (size > 0) {
+        ssize_t recvd = recv(sock, p, size, 0);
+        if (recvd <= 0) {
+            return false;
+        }
+        p += recvd;
+        size -= recvd;
+    }
+    return true;
+}
+
+
+size_t client_encode_chunk(const uint8_t *old_bitmap,
+    const uint8_t *new_bitmap, size_t size, struct chunk_header *ch,
+    uint8_t *out)
+{
+    if (!old_bitmap) {
+        // only worth it if it's smaller
+        const size_t new_size = rle_encode(new_bitmap, size, out, size - 1);
+        if (new_size > 0) {
+            *ch = (struct chunk_header){ CHUNK_RLE_XOR, 0, new_size };
+            return new_size;
+        }
+
+        *ch = (struct chunk_header){ CHUNK_RAW, 0, size };
+        memcpy(out, new_bitmap, size);
+        return size;
+    }
+
+    uint8_t *delta = malloc(size);
+    if (!delta) {
+        return 0;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        delta[i] = old_bitmap[i] ^ new_bitmap[i];
+    }
+
+    const size_t max_size = RLE_MAX_ENCODED_SIZE(size);
+    const size_t old_size = rle_encode(old_bitmap, size, out, max_size);
+    const size_t delta_size = rle_encode(delta, size, out + old_size,
+        max_size);
+    free(delta);
+
+    if (old_size + delta_size < 2 * size) {
+        *ch = (struct chunk_header){ CHUNK_RLE_XOR, old_size, delta_size };
+        return old_size + delta_size;
+    }
+
+    *ch = (struct chunk_header){ CHUNK_RAW, size, size };
+    memcpy(out, old_bitmap, size);
+    memcpy(out + size, new_bitmap, size);
+    return 2 * size;
+}
+
+
+// sends the command byte that picks mode, if it isn't the default
+static bool send_mode(int sock, enum EINK_MODE mode)
+{
+    uint8_t cmd;
+    switch (mode) {
+    case EINK_MODE_FAST:
+        cmd = PROTO_CMD_FAST;
+        break;
+    case EINK_MODE_PARTIAL:
+        cmd = PROTO_CMD_PARTIAL;
+        break;
+    default:
+        return true;
+    }
+    return client_send_all(sock, &cmd, sizeof(cmd));
+}
+
+// splits rectangles into bands of at most max_size bitmap bytes, in order.
+// returns the number of bands, or -1 if out of memory.
+static int split_bands(const struct rect *rects, int num_rects, int max_size,
+    struct rect **bands)
+{
+    int n = 0;
+    for (int i = 0; i < num_rects; ++i) {
+        const int band_h = max_size / BITMAP_ROW_SIZE(rects[i].w);
+        n += (rects[i].h + band_h - 1) / band_h;
+    }
+
+    *bands = malloc((n ? n : 1) * sizeof(**bands));
+    if (!*bands) {
+        return -1;
+    }
+
+    struct rect *band = *bands;
+    for (int i = 0; i < num_rects; ++i) {
+        const struct rect *r = &rects[i];
+        const int band_h = max_size / BITMAP_ROW_SIZE(r->w);
+
+        for (int y = 0; y < r->h; y += band_h, ++band) {
+            *band = (struct rect){ r->x, r->y + y, r->w, r->h - y };
+            if (band->h > band_h) {
+                band->h = band_h;
+            }
+        }
+    }
+    return n;
+}
+
+// old_frame may be NULL for the new-only commands
+static bool send_rect(int sock, const struct frame *old_frame,
+    const struct frame *new_frame, const struct rect *r, bool encoded,
+    uint8_t *old_buf, uint8_t *new_buf, uint8_t *enc_buf)
+{
+    struct rect_header rh = { r->x, r->y, r->w, r->h };
+    const size_t size = (size_t)r->h * BITMAP_ROW_SIZE(r->w);
+
+    if (!client_send_all(sock, &rh, sizeof(rh))) {
+        return false;
+    }
+
+    if (old_frame) {
+        frame_copy_rect(old_frame, r, old_buf);
+    }
+    frame_copy_rect(new_frame, r, new_buf);
+
+    if (!encoded) {
+        return (!old_frame || client_send_all(sock, old_buf, size))
+            && client_send_all(sock, new_buf, size);
+    }
+
+    struct chunk_header ch;
+    const size_t enc_size = client_encode_chunk(old_frame ? old_buf : NULL,
+        new_buf, size, &ch, enc_buf);
+    return client_send_all(sock, &ch, sizeof(ch))
+        && client_send_all(sock, enc_buf, enc_size);
+}
+
+bool client_send_rects(int sock, const struct frame *old_frame,
+    const struct frame *new_frame, const struct rect *rects, int num_rects,
+    bool encoded, enum EINK_MODE mode)
+{
+    if (!send_mode(sock, mode)) {
+        return false;
+    }
+
+    uint8_t cmd = encoded ? PROTO_CMD_RECTS_ENCODED : PROTO_CMD_RECTS;
+    if (!old_frame) {
+        cmd = encoded ? PROTO_CMD_RECTS_NEW_ENCODED : PROTO_CMD_RECTS_NEW;
+    }
+
+    struct rects_hello hello;
+    if (!client_send_all(sock, &cmd, sizeof(cmd))
+        || !client_recv_all(sock, &hello, sizeof(hello)))
+    {
+        return false;
+    }
+
+    if (PIXEL_BIT_SIZE != hello.pixel_bits) {
+        fprintf(stderr, "device has %d bit pixels, we have %d\n",
+            hello.pixel_bits, PIXEL_BIT_SIZE);
+        return false;
+    }
+
+    const size_t size = hello.max_bitmap_size;
+    uint8_t *old_buf = malloc(size);
+    uint8_t *new_buf = malloc(size);
+    uint8_t *enc_buf = malloc(2 * RLE_MAX_ENCODED_SIZE(size));
+
+    struct rect *bands = NULL;
+    const int num_bands = split_bands(rects, num_rects, size, &bands);
+
+    // send everything before reading the statuses, so the device never waits
+    // for the next rectangle
+    bool ok = old_buf && new_buf && enc_buf && bands;
+    for (int i = 0; ok && i < num_bands; ++i) {
+        ok = send_rect(sock, old_frame, new_frame, &bands[i], encoded,
+            old_buf, new_buf, enc_buf);
+    }
+
+    const struct rect_header end = {};
+    ok = ok && client_send_all(sock, &end, sizeof(end));
+
+    for (int i = 0; ok && i < num_bands; ++i) {
+        uint8_t status;
+        if (!client_recv_all(sock, &status, sizeof(status))) {
+            ok = false;
+        } else if (RECT_OK != status) {
+            fprintf(stderr, "device rejected a rectangle: %d\n", status);
+            ok = false;
+        }
+    }
+
+    free(old_buf);
+    free(new_buf);
+    free(enc_buf);
+    free(bands);
+    return ok;
+}
+
+
+uint32_t client_transfer_id(const struct frame *new_frame,
+    const struct rect *rects, int num_rects)
+{
+    uint32_t crc = crc32_update(0, rects, num_rects * sizeof(*rects));
+    return crc32_update(crc, new_frame->bits,
+        (size_t)new_frame->h * new_frame->stride);
+}
+
+static bool send_frame(int sock, const struct frame *new_frame,
+    const struct rect *r, uint32_t seq, uint8_t *new_buf, uint8_t *enc_buf)
+{
+    const size_t size = (size_t)r->h * BITMAP_ROW_SIZE(r->w);
+    frame_copy_rect(new_frame, r, new_buf);
+
+    struct chunk_header ch;
+    const size_t enc_size = client_encode_chunk(NULL, new_buf, size, &ch,
+        enc_buf);
+
+    struct frame_header fh = {
+        .magic = FRAME_MAGIC,
+        .seq = seq,
+        .x = r->x,
+        .y = r->y,
+        .w = r->w,
+        .h = r->h,
+        .length = sizeof(ch) + enc_size,
+    };
+    fh.crc = crc32_update(0, &fh, offsetof(struct frame_header, crc));
+    fh.crc = crc32_update(fh.crc, &ch, sizeof(ch));
+    fh.crc = crc32_update(fh.crc, enc_buf, enc_size);
+
+    return client_send_all(sock, &fh, sizeof(fh))
+        && client_send_all(sock, &ch, sizeof(ch))
+        && client_send_all(sock, enc_buf, enc_size);
+}
+
+enum FRAMED_RESULT {
+    FRAMED_DONE,
+    // the connection dropped or the device NAKed a rectangle
+    FRAMED_RETRY,
+    FRAMED_FAILED,
+};
+
+// one connection's worth of a framed transfer
+static enum FRAMED_RESULT send_framed_once(int sock,
+    const struct frame *new_frame, const struct rect *rects, int num_rects,
+    uint32_t transfer_id, enum EINK_MODE mode)
+{
+    const uint8_t cmd = PROTO_CMD_FRAMED;
+    struct framed_hello hello;
+    if (!send_mode(sock, mode)
+        || !client_send_all(sock, &cmd, sizeof(cmd))
+        || !client_send_all(sock, &transfer_id, sizeof(transfer_id))
+        || !client_recv_all(sock, &hello, sizeof(hello)))
+    {
+        return FRAMED_RETRY;
+    }
+
+    if (PIXEL_BIT_SIZE != hello.rects.pixel_bits) {
+        fprintf(stderr, "device has %d bit pixels, we have %d\n",
+            hello.rects.pixel_bits, PIXEL_BIT_SIZE);
+        return FRAMED_FAILED;
+    }
+
+    const size_t size = hello.rects.max_bitmap_size;
+    struct rect *bands = NULL;
+    const int num_bands = split_bands(rects, num_rects, size, &bands);
+    uint8_t *new_buf = malloc(size);
+    uint8_t *enc_buf = malloc(RLE_MAX_ENCODED_SIZE(size));
+
+    enum FRAMED_RESULT result = FRAMED_RETRY;
+    if (!(bands && new_buf && enc_buf)) {
+        fprintf(stderr, "out of memory\n");
+        result = FRAMED_FAILED;
+        goto out;
+    }
+    if (hello.resume_seq > num_bands) {
+        fprintf(stderr, "device is at rectangle %u of %d\n",
+            hello.resume_seq, num_bands);
+        result = FRAMED_FAILED;
+        goto out;
+    }
+    if (hello.resume_seq > 0) {
+        fprintf(stderr, "resuming at rectangle %u of %d\n",
+            hello.resume_seq, num_bands);
+    }
+
+    // as for client_send_rects, everything goes before reading the acks
+    for (uint32_t seq = hello.resume_seq; seq < num_bands; ++seq) {
+        if (!send_frame(sock, new_frame, &bands[seq], seq, new_buf,
+            enc_buf))
+        {
+            goto out;
+        }
+    }
+
+    const struct frame_header end = { .magic = FRAME_MAGIC };
+    if (!client_send_all(sock, &end, sizeof(end))) {
+        goto out;
+    }
+
+    for (uint32_t seq = hello.resume_seq; seq < num_bands; ++seq) {
+        struct frame_ack ack;
+        if (!client_recv_all(sock, &ack, sizeof(ack))) {
+            goto out;
+        }
+        if (RECT_NAK == ack.status) {
+            fprintf(stderr, "device NAKed rectangle %u\n", ack.seq);
+            goto out;
+        }
+        if (RECT_OK != ack.status) {
+            fprintf(stderr, "device rejected rectangle %u: %d\n", ack.seq,
+                ack.status);
+            result = FRAMED_FAILED;
+            goto out;
+        }
+    }
+    result = FRAMED_DONE;
+
+out:
+    free(bands);
+    free(new_buf);
+    free(enc_buf);
+    return result;
+}
+
+// how long to wait before reconnecting, times the number of tries so far
+#define FRAMED_RETRY_DELAY_MS 500
+
+bool client_send_framed(const char *addr, const struct frame *new_frame,
+    const struct rect *rects, int num_rects, uint32_t transfer_id,
+    enum EINK_MODE mode, int max_retries)
+{
+    for (int tries = 0; tries <= max_retries; ++tries) {
+        if (tries > 0) {
+            fprintf(stderr, "reconnecting\n");
+            usleep(tries * FRAMED_RETRY_DELAY_MS * 1000);
+        }
+
+        int sock = client_connect(addr);
+        if (sock < 0) {
+            continue;
+        }
+
+        const enum FRAMED_RESULT result = send_framed_once(sock, new_frame,
+            rects, num_rects, transfer_id, mode);
+        close(sock);
+
+        if (FRAMED_RETRY != result) {
+            return FRAMED_DONE == result;
+        }
+    }
+
+    fprintf(stderr, "giving up after %d tries\n", max_retries + 1);
+    return false;
+}
+
+
+int client_send_waveform(const char *addr, const void *data, size_t size)
+{
+    int sock = client_connect(addr);
+    if (sock < 0) {
+        return -1;
+    }
+
+    const uint8_t cmd = PROTO_CMD_WAVEFORM;
+    const uint32_t size32 = size;
+    uint8_t status;
+    const bool ok = client_send_all(sock, &cmd, sizeof(cmd))
+        && client_send_all(sock, &size32, sizeof(size32))
+        && client_send_all(sock, data, size)
+        && client_recv_all(sock, &status, sizeof(status));
+    close(sock);
+
+    return ok ? status : -1;
+}
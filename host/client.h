@@ -0,0 +1,64 @@
+#ifndef __CLIENT_H__
+#define __CLIENT_H__
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "eink.h"
+#include "frame.h"
+#include "protocol.h"
+
+
+// connects to "host" or "host:port" (LISTEN_PORT by default). returns a
+// socket, or -1 on error.
+int client_connect(const char *addr);
+
+bool client_send_all(int sock, const void *buf, size_t size);
+bool client_recv_all(int sock, void *buf, size_t size);
+
+// sends the given rectangles of new_frame over old_frame with
+// PROTO_CMD_RECTS, splitting rectangles into bands that fit the device's
+// buffer, and waits until the device has drawn all of them.
+// with encoded, uses PROTO_CMD_RECTS_ENCODED and sends each rectangle as
+// CHUNK_RLE_XOR when that is smaller.
+// with no old_frame, uses PROTO_CMD_RECTS_NEW(_ENCODED) and sends only the
+// new bitmaps.
+// with EINK_MODE_FAST or EINK_MODE_PARTIAL, starts with PROTO_CMD_FAST or
+// PROTO_CMD_PARTIAL.
+bool client_send_rects(int sock, const struct frame *old_frame,
+    const struct frame *new_frame, const struct rect *rects, int num_rects,
+    bool encoded, enum EINK_MODE mode);
+
+// how many times the tools reconnect before giving up on a framed transfer
+#define DEFAULT_FRAMED_RETRIES 5
+
+// sends the given rectangles of new_frame with PROTO_CMD_FRAMED as
+// transfer_id, connecting to addr, and waits until the device has drawn all
+// of them. when the connection drops or the device NAKs a rectangle, it
+// reconnects, up to max_retries times, and sends only what the device hasn't
+// drawn. mode is as for client_send_rects.
+bool client_send_framed(const char *addr, const struct frame *new_frame,
+    const struct rect *rects, int num_rects, uint32_t transfer_id,
+    enum EINK_MODE mode, int max_retries);
+
+// a transfer id for sending rects of new_frame, the same every time, so a
+// transfer that a client gave up on can be resumed by running it again
+uint32_t client_transfer_id(const struct frame *new_frame,
+    const struct rect *rects, int num_rects);
+
+// sends a waveform file of size bytes with PROTO_CMD_WAVEFORM, or with size
+// 0 reverts the device to its built in waveforms. returns the enum
+// WAVEFORM_STATUS the device answered with, or -1 if that never came.
+int client_send_waveform(const char *addr, const void *data, size_t size);
+
+// encodes a chunk's old and new bitmaps, size bytes each, as CHUNK_RLE_XOR
+// into out (which needs room for 2 * RLE_MAX_ENCODED_SIZE(size) bytes),
+// falling back to CHUNK_RAW when that isn't smaller. fills in *ch and returns
+// the payload size.
+// with no old_bitmap, encodes just the new one, for the new-only commands.
+size_t client_encode_chunk(const uint8_t *old_bitmap,
+    const uint8_t *new_bitmap, size_t size, struct chunk_header *ch,
+    uint8_t *out);
+
+
+#endif
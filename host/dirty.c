@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+#include "eink.h"
+#include "dirty.h"
+
+
+// differences are first collected on a grid of cells, which are made coarser
+// until there are few enough rectangles to merge pairwise
+#define MIN_CELL_SIZE       8
+#define MAX_MERGE_RECTS     256
+
+
+static inline int max_int(int a, int b) { return a > b ? a : b; }
+static inline int min_int(int a, int b) { return a < b ? a : b; }
+
+static long rect_cost(const struct rect *r, int per_rect_cost)
+{
+    // old and new bitmaps
+    return per_rect_cost + 2L * r->h * BITMAP_ROW_SIZE(r->w);
+}
+
+static struct rect rect_union(const struct rect *a, const struct rect *b)
+{
+    const int x0 = min_int(a->x, b->x);
+    const int y0 = min_int(a->y, b->y);
+    const int x1 = max_int(a->x + a->w, b->x + b->w);
+    const int y1 = max_int(a->y + a->h, b->y + b->h);
+    return (struct rect){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+static bool rects_overlap(const struct rect *a, const struct rect *b)
+{
+    return a->x < b->x + b->w && b->x < a->x + a->w
+        && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+
+// marks the cells that contain differing pixels
+static void find_dirty_cells(const struct frame *old_frame,
+    const struct frame *new_frame, int cell_size, int grid_w, uint8_t *grid)
+{
+    for (int y = 0; y < old_frame->h; ++y) {
+        const uint8_t *old_row = frame_row(old_frame, y);
+        const uint8_t *new_row = frame_row(new_frame, y);
+        uint8_t *grid_row = grid + (y / cell_size) * grid_w;
+
+        for (int i = 0; i < old_frame->stride; ++i) {
+            if (old_row[i] == new_row[i]) {
+                continue;
+            }
+
+            const int x = i * PIXELS_PER_BYTE;
+            const int last_x = min_int(x + PIXELS_PER_BYTE, old_frame->w) - 1;
+            for (int gx = x / cell_size; gx <= last_x / cell_size; ++gx) {
+                grid_row[gx] = 1;
+            }
+        }
+    }
+}
+
+// covers the dirty cells with rectangles of cells, each grown right and then
+// down as far as it goes. returns the number of rectangles, or -1 if there
+// were more than max_rects.
+static int cover_dirty_cells(uint8_t *grid, int grid_w, int grid_h,
+    struct rect *rects, int max_rects)
+{
+    int n = 0;
+    for (int gy = 0; gy < grid_h; ++gy) {
+        for (int gx = 0; gx < grid_w; ++gx) {
+            if (!grid[gy * grid_w + gx]) {
+                continue;
+            }
+
+            int w = 1;
+            while (gx + w < grid_w && grid[gy * grid_w + gx + w]) {
+                ++w;
+            }
+
+            int h = 1;
+            for (; gy + h < grid_h; ++h) {
+                const uint8_t *row = grid + (gy + h) * grid_w + gx;
+                if (memchr(row, 0, w)) {
+                    break;
+                }
+            }
+
+            for (int y = gy; y < gy + h; ++y) {
+                memset(grid + y * grid_w + gx, 0, w);
+            }
+
+            if (n == max_rects) {
+                return -1;
+            }
+            rects[n++] = (struct rect){ gx, gy, w, h };
+        }
+    }
+    return n;
+}
+
+// shrinks a rectangle to the differing pixels inside it. returns false if
+// there are none.
+static bool shrink_to_diff(const struct frame *old_frame,
+    const struct frame *new_frame, struct rect *r)
+{
+    int x0 = r->x + r->w, y0 = r->y + r->h, x1 = r->x, y1 = r->y;
+
+    for (int y = r->y; y < r->y + r->h; ++y) {
+        const uint8_t *old_row = frame_row(old_frame, y);
+        const uint8_t *new_row = frame_row(new_frame, y);
+        for (int x = r->x; x < r->x + r->w; ++x) {
+            if (get_row_pixel(old_row, x) != get_row_pixel(new_row, x)) {
+                x0 = min_int(x0, x);
+                x1 = max_int(x1, x + 1);
+                y0 = min_int(y0, y);
+                y1 = max_int(y1, y + 1);
+            }
+        }
+    }
+
+    if (x1 <= x0) {
+        return false;
+    }
+
+    *r = (struct rect){ x0, y0, x1 - x0, y1 - y0 };
+    return true;
+}
+
+// grows the union of rects[i] and rects[j] until it overlaps no other
+// rectangle. returns how much cheaper it is than the rectangles it covers.
+static long merge_saving(const struct rect *rects, int n, int i, int j,
+    int per_rect_cost, struct rect *merged)
+{
+    struct rect u = rect_union(&rects[i], &rects[j]);
+    long separate_cost = rect_cost(&rects[i], per_rect_cost)
+        + rect_cost(&rects[j], per_rect_cost);
+
+    // absorbing a rectangle can make the union overlap earlier ones again
+    uint8_t absorbed[MAX_MERGE_RECTS] = {};
+    absorbed[i] = absorbed[j] = 1;
+    for (bool grew = true; grew; ) {
+        grew = false;
+        for (int k = 0; k < n; ++k) {
+            if (!absorbed[k] && rects_overlap(&u, &rects[k])) {
+                u = rect_union(&u, &rects[k]);
+                separate_cost += rect_cost(&rects[k], per_rect_cost);
+                absorbed[k] = 1;
+                grew = true;
+            }
+        }
+    }
+
+    *merged = u;
+    return separate_cost - rect_cost(&u, per_rect_cost);
+}
+
+// merges rectangles while that makes them cheaper. returns the new count.
+static int merge_rects(struct rect *rects, int n, int per_rect_cost)
+{
+    for (;;) {
+        long best_saving = -1;
+        int best_i = -1, best_j = -1;
+        struct rect best_merged;
+
+        for (int i = 0; i < n; ++i) {
+            for (int j = i + 1; j < n; ++j) {
+                // cheap upper bound before looking for overlaps
+                struct rect u = rect_union(&rects[i], &rects[j]);
+                long bound = rect_cost(&rects[i], per_rect_cost)
+                    + rect_cost(&rects[j], per_rect_cost)
+                    - rect_cost(&u, per_rect_cost);
+                if (bound <= best_saving) {
+                    continue;
+                }
+
+                struct rect merged;
+                long saving = merge_saving(rects, n, i, j, per_rect_cost,
+                    &merged);
+                if (saving > best_saving) {
+                    best_saving = saving;
+                    best_i = i;
+                    best_j = j;
+                    best_merged = merged;
+                }
+            }
+        }
+
+        if (best_i < 0) {
+            return n;
+        }
+
+        // drop everything the merged rectangle covers, then add it
+        int m = 0;
+        for (int k = 0; k < n; ++k) {
+            if (k != best_i && k != best_j
+                && !rects_overlap(&best_merged, &rects[k]))
+            {
+                rects[m++] = rects[k];
+            }
+        }
+        rects[m++] = best_merged;
+        n = m;
+    }
+}
+
+struct rect *find_dirty_rects(const struct frame *old_frame,
+    const struct frame *new_frame, int per_rect_cost, int *num_rects)
+{
+    struct rect *rects = malloc(MAX_MERGE_RECTS * sizeof(*rects));
+    if (!rects) {
+        return NULL;
+    }
+
+    int n;
+    int cell_size;
+    for (cell_size = MIN_CELL_SIZE; ; cell_size *= 2) {
+        const int grid_w = (old_frame->w + cell_size - 1) / cell_size;
+        const int grid_h = (old_frame->h + cell_size - 1) / cell_size;
+        uint8_t *grid = calloc(grid_w, grid_h);
+        if (!grid) {
+            free(rects);
+            return NULL;
+        }
+
+        find_dirty_cells(old_frame, new_frame, cell_size, grid_w, grid);
+        n = cover_dirty_cells(grid, grid_w, grid_h, rects, MAX_MERGE_RECTS);
+        free(grid);
+
+        if (n >= 0) {
+            break;
+        }
+    }
+
+    // cells to pixels, shrunk to what actually changed
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        struct rect r = {
+            rects[i].x * cell_size,
+            rects[i].y * cell_size,
+            rects[i].w * cell_size,
+            rects[i].h * cell_size,
+        };
+        r.w = min_int(r.w, old_frame->w - r.x);
+        r.h = min_int(r.h, old_frame->h - r.y);
+
+        if (shrink_to_diff(old_frame, new_frame, &r)) {
+            rects[m++] = r;
+        }
+    }
+
+    *num_rects = merge_rects(rects, m, per_rect_cost);
+    return rects;
+}
@@ -0,0 +1,23 @@
+#ifndef __DIRTY_H__
+#define __DIRTY_H__
+
+
+#include "frame.h"
+
+
+// default cost of sending one more rectangle, in bitmap bytes. the device
+// draws rectangles that fit in its buffer together, so a rectangle costs
+// little more than its header and its partial bytes at the edges.
+#define DEFAULT_RECT_COST 64
+
+
+// finds non-overlapping rectangles that together cover every pixel that
+// differs between two frames of the same size. neighbouring rectangles are
+// merged while the merged rectangle's bitmaps cost less than rect_cost more
+// than the separate ones'.
+// returns a malloc()ed array and its size in *num_rects, or NULL on error.
+struct rect *find_dirty_rects(const struct frame *old_frame,
+    const struct frame *new_frame, int rect_cost, int *num_rects);
+
+
+#endif
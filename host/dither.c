@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include "eink.h"
+#include "dither.h"
+
+#if defined(__SSE2__) && !defined(DITHER_SCALAR)
+#define DITHER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+
+// a pixel's level is ((255 - grey) * (NUM_GREY_LEVELS - 1) + offset) / 255:
+// offset 127 rounds to the nearest level, and the ordered offsets spread
+// over 0..255 round up or down in a fixed pattern. at 1 bit per pixel that
+// comes down to black where grey < offset + 1.
+#define NEAREST_OFFSET 127
+
+static const uint8_t bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+// the offsets of row y, 16 of them so a vector covers them
+#define OFFSET_ROW_SIZE 16
+
+static void get_offsets(enum DITHER dither, int y, uint8_t *offsets)
+{
+    for (int i = 0; i < OFFSET_ROW_SIZE; ++i) {
+        offsets[i] = (DITHER_ORDERED == dither)
+            ? (2 * bayer8[y % 8][i % 8] + 1) * 255 / 128
+            : NEAREST_OFFSET;
+    }
+}
+
+
+#if PIXEL_BIT_SIZE == 1
+
+static uint8_t reversed_bits[256];
+
+static void init_reversed_bits(void)
+{
+    for (int i = 0; i < 256; ++i) {
+        uint8_t r = 0;
+        for (int bit = 0; bit < 8; ++bit) {
+            r |= ((i >> bit) & 1) << (7 - bit);
+        }
+        reversed_bits[i] = r;
+    }
+}
+
+// sets the bits of out, which must start out 0, for pixels x.. that are
+// black
+static void threshold_span(const uint8_t *grey, const uint8_t *thresholds,
+    int x, int w, uint8_t *out)
+{
+    for (; x < w; ++x) {
+        if (grey[x] < thresholds[x % OFFSET_ROW_SIZE]) {
+            out[x / 8] |= 0x80 >> (x % 8);
+        }
+    }
+}
+
+// 16 pixels at a time. movemask gives the first pixel in the low bit,
+// where the bitmap wants it in the high bit, so each byte is reversed.
+static void threshold_row(const uint8_t *grey, const uint8_t *thresholds,
+    int w, uint8_t *out)
+{
+    int x = 0;
+#ifdef DITHER_SSE2
+    // SSE2 only compares signed bytes, so both sides are offset by 128
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i t = _mm_xor_si128(
+        _mm_loadu_si128((const __m128i *)thresholds), bias);
+
+    for (; x + 16 <= w; x += 16) {
+        const __m128i g = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i *)(grey + x)), bias);
+        const int mask = _mm_movemask_epi8(_mm_cmplt_epi8(g, t));
+        out[x / 8] = reversed_bits[mask & 0xff];
+        out[x / 8 + 1] = reversed_bits[mask >> 8];
+    }
+#endif
+    threshold_span(grey, thresholds, x, w, out);
+}
+
+#else
+
+// any depth, a pixel at a time
+static void level_row(const uint8_t *grey, const uint8_t *offsets, int w,
+    uint8_t *out)
+{
+    for (int x = 0; x < w; ++x) {
+        int level = ((255 - grey[x]) * (NUM_GREY_LEVELS - 1)
+            + offsets[x % OFFSET_ROW_SIZE]) / 255;
+        if (level > NUM_GREY_LEVELS - 1) {
+            level = NUM_GREY_LEVELS - 1;
+        }
+        set_row_pixel(out, x, level);
+    }
+}
+
+#endif
+
+static void dither_fixed(struct frame *f, const uint8_t *grey,
+    enum DITHER dither)
+{
+#if PIXEL_BIT_SIZE == 1
+    init_reversed_bits();
+#endif
+
+    for (int y = 0; y < f->h; ++y) {
+        const uint8_t *grey_row = grey + (size_t)y * f->w;
+        uint8_t *row = frame_row(f, y);
+        uint8_t offsets[OFFSET_ROW_SIZE];
+        get_offsets(dither, y, offsets);
+
+        memset(row, 0, f->stride);
+#if PIXEL_BIT_SIZE == 1
+        for (int i = 0; i < OFFSET_ROW_SIZE; ++i) {
+            // black where grey < offset + 1; offsets are under 255
+            ++offsets[i];
+        }
+        threshold_row(grey_row, offsets, f->w, row);
+#else
+        level_row(grey_row, offsets, f->w, row);
+#endif
+    }
+}
+
+
+// error is kept in darkness units, 0 for white to 255 for black, and each
+// pixel's is passed 7/16 on, and 3/16, 5/16 and 1/16 to the row below
+static bool dither_diffuse(struct frame *f, const uint8_t *grey)
+{
+    // one spare entry each side, so the edges need no checks
+    int16_t *errs = calloc(2 * (f->w + 2), sizeof(*errs));
+    if (!errs) {
+        return false;
+    }
+    int16_t *err = errs + 1;
+    int16_t *next_err = errs + f->w + 3;
+
+    for (int y = 0; y < f->h; ++y) {
+        const uint8_t *grey_row = grey + (size_t)y * f->w;
+        uint8_t *row = frame_row(f, y);
+        const bool rtl = y & 1;
+        const int dir = rtl ? -1 : 1;
+
+        memset(next_err - 1, 0, (f->w + 2) * sizeof(*next_err));
+        for (int i = 0; i < f->w; ++i) {
+            const int x = rtl ? f->w - 1 - i : i;
+            const int dark = 255 - grey_row[x] + err[x];
+
+            int level = (dark * (NUM_GREY_LEVELS - 1) + 127) / 255;
+            if (dark <= 0) {
+                level = 0;
+            } else if (level > NUM_GREY_LEVELS - 1) {
+                level = NUM_GREY_LEVELS - 1;
+            }
+            set_row_pixel(row, x, level);
+
+            const int e = dark - level * 255 / (NUM_GREY_LEVELS - 1);
+            err[x + dir] += e * 7 / 16;
+            next_err[x - dir] += e * 3 / 16;
+            next_err[x] += e * 5 / 16;
+            next_err[x + dir] += e / 16;
+        }
+
+        int16_t *tmp = err;
+        err = next_err;
+        next_err = tmp;
+    }
+
+    free(errs);
+    return true;
+}
+
+
+bool dither_grey(struct frame *f, const uint8_t *grey, enum DITHER dither)
+{
+    if (DITHER_DIFFUSE == dither) {
+        return dither_diffuse(f, grey);
+    }
+
+    dither_fixed(f, grey, dither);
+    return true;
+}
+
+bool dither_parse(const char *name, enum DITHER *dither)
+{
+    static const char *const names[] = { "none", "ordered", "diffuse" };
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (0 == strcmp(name, names[i])) {
+            *dither = i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,30 @@
+#ifndef __DITHER_H__
+#define __DITHER_H__
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "frame.h"
+
+
+enum DITHER {
+    // the nearest grey level
+    DITHER_NONE = 0,
+    // an 8x8 Bayer matrix
+    DITHER_ORDERED,
+    // Floyd-Steinberg error diffusion, in alternating directions
+    DITHER_DIFFUSE,
+};
+
+
+// converts rows of 8 bit grey pixels, 0 for black to 255 for white, f->w
+// wide and f->h high, to f's grey levels. returns false if out of memory.
+// at 1 bit per pixel, DITHER_NONE and DITHER_ORDERED use SSE2 where the
+// compiler has it, unless built with -DDITHER_SCALAR.
+bool dither_grey(struct frame *f, const uint8_t *grey, enum DITHER dither);
+
+// parses "none", "ordered" or "diffuse"
+bool dither_parse(const char *name, enum DITHER *dither);
+
+
+#endif
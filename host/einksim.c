@@ -0,0 +1,291 @@
+// runs the eink driver against the mock hardware backend and reports what
+// each call would cost on the board.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "eink.h"
+#include "chunk.h"
+#include "hal_mock.h"
+#include "perf.h"
+#include "waveform.h"
+
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+static double call_start_ms;
+
+static void begin_call(void)
+{
+    hal_mock_reset_counters();
+    call_start_ms = now_ms();
+}
+
+static void end_call(const char *name)
+{
+    const double cpu_ms = now_ms() - call_start_ms;
+    const struct hal_mock_counters *c = &hal_mock_counters;
+    printf("%-24s %9u %10u %11u %10.3f %10.3f %8.3f\n", name,
+        c->spi_words, c->pin_writes, c->pin_toggles,
+        c->delay_ns / 1e6, c->model_ns / 1e6, cpu_ms);
+}
+
+
+// a frame that alternates 8x8 black and white squares, shifted by phase
+static bool get_rows_checker(void *arg, int y, int x0, int x1,
+    uint8_t *old_row, uint8_t *new_row)
+{
+    const int *phase = arg;
+    for (int x = x0; x < x1; ++x) {
+        set_row_pixel(old_row, x - x0, WHITE);
+        set_row_pixel(new_row, x - x0,
+            (((x + *phase) / 8 + y / 8) & 1) ? BLACK : WHITE);
+    }
+    return true;
+}
+
+// the checkerboard, but with every other band of 4 rows left unchanged
+static bool get_rows_banded(void *arg, int y, int x0, int x1,
+    uint8_t *old_row, uint8_t *new_row)
+{
+    get_rows_checker(arg, y, x0, x1, old_row, new_row);
+    if ((y / 4) & 1) {
+        memcpy(new_row, old_row, BITMAP_ROW_SIZE(x1 - x0));
+    }
+    return true;
+}
+
+// rectangle headers as a client could send them, including ones whose far
+// edges or bitmap sizes overflow an int
+static bool check_rect_headers(void)
+{
+    static const struct {
+        struct rect_header rh;
+        enum RECT_STATUS status;
+    } cases[] = {
+        { { 0, 0, 8, 8 }, RECT_OK },
+        { { 0, 0, SCREEN_BITMAP_WIDTH, 1 }, RECT_OK },
+        { { 0, 0, 0, 0 }, RECT_OK },
+        { { -1, 0, 8, 8 }, RECT_ERR_BOUNDS },
+        { { 1, 0, SCREEN_BITMAP_WIDTH, 1 }, RECT_ERR_BOUNDS },
+        { { 100, 0, INT32_MAX, 1 }, RECT_ERR_BOUNDS },
+        { { 0, 100, 1, INT32_MAX }, RECT_ERR_BOUNDS },
+        { { INT32_MAX, 0, 1, 1 }, RECT_ERR_BOUNDS },
+        { { 0, 0, SCREEN_BITMAP_WIDTH, SCREEN_BITMAP_HEIGHT }, RECT_ERR_SIZE },
+    };
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const struct rect_header *rh = &cases[i].rh;
+        const enum RECT_STATUS status = chunk_check_rect(rh);
+        if (status != cases[i].status) {
+            fprintf(stderr, "rect %d,%d %dx%d: status %d, expected %d\n",
+                rh->x, rh->y, rh->w, rh->h, status, cases[i].status);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// updates two regions with rows above, between and below them, and checks
+// that the source drivers' outputs are only enabled for the rows the mode
+// drives and the clear row ending each stage. skipped rows must be clocked
+// past with them off, or they'd be driven with whatever is latched.
+static bool check_skipped_rows(enum EINK_MODE mode, int rows_driven)
+{
+    static const struct eink_region regions[] = {
+        { 0, 10, 100, 20 },
+        { 0, 100, 100, 110 },
+    };
+
+    int num_stages = 0;
+    for (;; ++num_stages) {
+        uint32_t ckv_high_ns, ckv_low_ns;
+        get_update_waveform_timings(mode, TEMP_BAND_COLD, num_stages,
+            &ckv_high_ns, &ckv_low_ns);
+        if (0 == ckv_high_ns) {
+            break;
+        }
+    }
+
+    int phase = 0;
+    hal_mock_reset_counters();
+    eink_update_regions(mode, get_rows_banded, &phase, regions, 2);
+
+    const uint32_t expected = num_stages * (rows_driven + 1);
+    const uint32_t driven = hal_mock_counters.ckv_driven_pulses;
+    printf("%-24s %u of %u row clocks driven, expected %u\n",
+        "skipped rows", driven, hal_mock_counters.ckv_pulses, expected);
+    return driven == expected;
+}
+
+// stands in for the board's temperature sensor. arg is the temperature.
+static bool get_fixed_temp(void *arg, int *temp_c)
+{
+    *temp_c = *(const int *)arg;
+    return true;
+}
+
+static void fill_chunks(int x, int y, int w, int h)
+{
+    const int byte_w = BITMAP_ROW_SIZE(w);
+    struct chunk_buf *buf = &chunk_bufs[0];
+    memset(buf->old_bits, 0, h * byte_w);
+    for (int row_y = 0; row_y < h; ++row_y) {
+        for (int i = 0; i < w; ++i) {
+            set_row_pixel(buf->new_bits + row_y * byte_w, i,
+                (((x + i) / 8 + (y + row_y) / 8) & 1) ? BLACK : WHITE);
+        }
+    }
+}
+
+// the same walk over the screen as handle_conn
+static void tiled_update(void)
+{
+    uint64_t total_model_ns = 0;
+    uint32_t total_spi_words = 0;
+
+    for (int y = 0; y < SCREEN_BITMAP_HEIGHT; y += CHUNK_HEIGHT - CHUNK_OVERLAP) {
+        for (int x = 0; x < SCREEN_BITMAP_WIDTH; x += CHUNK_WIDTH - CHUNK_OVERLAP) {
+            int w = SCREEN_BITMAP_WIDTH - x;
+            if (w > CHUNK_WIDTH) w = CHUNK_WIDTH;
+
+            int h = SCREEN_BITMAP_HEIGHT - y;
+            if (h > CHUNK_HEIGHT) h = CHUNK_HEIGHT;
+
+            fill_chunks(x, y, w, h);
+
+            struct chunk_params cp = {
+                .buf = &chunk_bufs[0],
+                .has_old = true,
+                .x = SCREEN_BITMAP_X_OFS + x,
+                .y = SCREEN_BITMAP_Y_OFS + y,
+                .byte_w = BITMAP_ROW_SIZE(w),
+            };
+
+            char name[32];
+            snprintf(name, sizeof(name), "tile %d,%d", x, y);
+
+            const struct eink_region region = {
+                SCREEN_BITMAP_X_OFS + x,
+                SCREEN_BITMAP_Y_OFS + y,
+                SCREEN_BITMAP_X_OFS + x + w,
+                SCREEN_BITMAP_Y_OFS + y + h,
+            };
+
+            begin_call();
+            eink_update_spans(EINK_MODE_FULL, get_rows_from_chunks, &cp,
+                &region, 1);
+            end_call(name);
+
+            total_model_ns += hal_mock_counters.model_ns;
+            total_spi_words += hal_mock_counters.spi_words;
+        }
+    }
+
+    printf("%-24s %9u %10s %11s %10s %10.3f\n", "tiled frame total",
+        total_spi_words, "-", "-", "-", total_model_ns / 1e6);
+}
+
+
+int main(int argc, char **argv)
+{
+    printf("%-24s %9s %10s %11s %10s %10s %8s\n", "call",
+        "spi_words", "pin_writes", "pin_toggles", "delay_ms", "model_ms",
+        "cpu_ms");
+
+    begin_call();
+    if (!eink_setup()) {
+        fprintf(stderr, "eink setup fail\n");
+        return 1;
+    }
+    end_call("eink_setup");
+
+    begin_call();
+    eink_power_on();
+    end_call("eink_power_on");
+
+    begin_call();
+    eink_refresh(WHITE);
+    end_call("eink_refresh");
+
+    struct eink_timing t;
+    eink_get_timing(&t);
+
+    int phase = 0;
+    begin_call();
+    eink_full_update(get_rows_checker, &phase);
+    end_call("eink_full_update");
+
+    eink_get_timing(&t);
+    printf("%-24s %uMHz, SR write %uns, CKV high %uns (asked %uns), "
+        "low %uns (asked %uns)\n", "timing", t.cpu_mhz, t.sr_write_ns,
+        t.ckv_high_ns, t.ckv_high_requested_ns,
+        t.ckv_low_ns, t.ckv_low_requested_ns);
+
+    begin_call();
+    eink_update(EINK_MODE_FULL, get_rows_checker, &phase, 600, 0, 800, 40);
+    end_call("eink_update 200x40");
+
+    begin_call();
+    eink_update(EINK_MODE_FAST, get_rows_checker, &phase, 600, 0, 800, 40);
+    end_call("eink_update fast 200x40");
+
+    // a warm panel takes shorter timings
+    int temp_c = 25;
+    eink_set_temp_source(get_fixed_temp, &temp_c);
+    begin_call();
+    eink_update(EINK_MODE_FULL, get_rows_checker, &phase, 600, 0, 800, 40);
+    end_call("eink_update 200x40 25C");
+    eink_set_temp_source(NULL, NULL);
+
+    tiled_update();
+
+    // the same frame as 12 non-overlapping regions in one set of scans
+    struct eink_region regions[12];
+    for (int i = 0; i < 12; ++i) {
+        const int x = (i % 4) * 200;
+        const int y = (i / 4) * 200;
+        regions[i] = (struct eink_region){ x, y, x + 200, y + 200 };
+    }
+    begin_call();
+    eink_update_regions(EINK_MODE_FULL, get_rows_checker, &phase,
+        regions, 12);
+    end_call("eink_update_regions 12x");
+
+    // full updates drive every row of the regions, the others only the 10
+    // that change
+    if (!check_skipped_rows(EINK_MODE_FULL, 20)
+        || !check_skipped_rows(EINK_MODE_PARTIAL, 10)
+        || !check_skipped_rows(EINK_MODE_FAST, 10))
+    {
+        fprintf(stderr, "rows were driven that should have been skipped\n");
+        return 1;
+    }
+
+    if (!check_rect_headers()) {
+        return 1;
+    }
+
+    begin_call();
+    eink_power_off();
+    end_call("eink_power_off");
+
+    // what the device would report for PROTO_CMD_STATS, in modelled time
+    printf("\n%-24s %9s %10s %10s\n", "perf", "n", "mean_us", "max_us");
+    for (int i = 0; i < NUM_PERF_HISTS; ++i) {
+        const struct perf_hist *h = &perf_hists[i];
+        if (h->count > 0) {
+            printf("%-24s %9u %10u %10u\n", perf_hist_names[i], h->count,
+                (uint32_t)(h->sum_us / h->count), h->max_us);
+        }
+    }
+
+    return 0;
+}
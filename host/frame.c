@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eink.h"
+#include "dither.h"
+#include "frame.h"
+#include "image.h"
+
+
+bool frame_alloc(struct frame *f, int w, int h)
+{
+    f->w = w;
+    f->h = h;
+    f->stride = BITMAP_ROW_SIZE(w);
+    f->bits = calloc(h, f->stride);
+    return NULL != f->bits;
+}
+
+void frame_free(struct frame *f)
+{
+    free(f->bits);
+    f->bits = NULL;
+}
+
+
+bool frame_load_pnm(struct frame *f, const char *path)
+{
+    struct image img;
+    if (!image_load(&img, path)) {
+        return false;
+    }
+
+    bool ok = false;
+    uint8_t *grey = malloc((size_t)img.w * img.h);
+    if (grey && frame_alloc(f, img.w, img.h)) {
+        image_get_grey(&img, 0, 0, img.w, img.h, grey);
+        ok = dither_grey(f, grey, DITHER_NONE);
+        if (!ok) {
+            frame_free(f);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: out of memory\n", path);
+    }
+
+    free(grey);
+    image_free(&img);
+    return ok;
+}
+
+bool frame_save_pnm(const struct frame *f, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+
+    bool ok;
+    if (1 == PIXEL_BIT_SIZE) {
+        // a PBM's rows are the bitmap's, black is 1 in both
+        ok = fprintf(fp, "P4\n%d %d\n", f->w, f->h) > 0
+            && 1 == fwrite(f->bits, (size_t)f->stride * f->h, 1, fp);
+    } else {
+        ok = fprintf(fp, "P5\n%d %d\n255\n", f->w, f->h) > 0;
+        for (int y = 0; ok && y < f->h; ++y) {
+            for (int x = 0; ok && x < f->w; ++x) {
+                const pixel_t p = get_row_pixel(frame_row(f, y), x);
+                ok = EOF != fputc(255 - p * 255 / (NUM_GREY_LEVELS - 1), fp);
+            }
+        }
+    }
+
+    if (0 != fclose(fp) || !ok) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return false;
+    }
+    return true;
+}
+
+
+void frame_copy_rect(const struct frame *f, const struct rect *r,
+    uint8_t *out)
+{
+    const int byte_w = BITMAP_ROW_SIZE(r->w);
+    memset(out, 0, (size_t)byte_w * r->h);
+
+    for (int y = 0; y < r->h; ++y) {
+        const uint8_t *src = frame_row(f, r->y + y);
+        uint8_t *dst = out + (size_t)y * byte_w;
+
+        if (0 == r->x % PIXELS_PER_BYTE) {
+            memcpy(dst, src + r->x / PIXELS_PER_BYTE, byte_w);
+            // clear the pixels past the rectangle in the last byte
+            for (int x = r->w; x < byte_w * PIXELS_PER_BYTE; ++x) {
+                set_row_pixel(dst, x, 0);
+            }
+        } else {
+            for (int x = 0; x < r->w; ++x) {
+                set_row_pixel(dst, x, get_row_pixel(src, r->x + x));
+            }
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// a whole screen image in the driver's bitmap format: rows of stride bytes,
+// leftmost pixel in the MSB (see get_row_pixel)
+struct frame {
+    int w;
+    int h;
+    int stride;
+    uint8_t *bits;
+};
+
+struct rect {
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+
+// allocates an all-white frame
+bool frame_alloc(struct frame *f, int w, int h);
+void frame_free(struct frame *f);
+
+// loads a binary PBM (P4), PGM (P5) or PPM (P6) file, quantizing grey to
+// the nearest of the NUM_GREY_LEVELS levels
+bool frame_load_pnm(struct frame *f, const char *path);
+
+// saves a PBM file at 1 bit per pixel, a PGM file otherwise
+bool frame_save_pnm(const struct frame *f, const char *path);
+
+static inline uint8_t *frame_row(const struct frame *f, int y)
+{
+    return f->bits + (size_t)y * f->stride;
+}
+
+// copies a rectangle of the frame into rows of BITMAP_ROW_SIZE(r->w) bytes,
+// as the protocol sends them
+void frame_copy_rect(const struct frame *f, const struct rect *r,
+    uint8_t *out);
+
+
+#endif
@@ -0,0 +1,168 @@
+#include <string.h>
+#include "eink_hal.h"
+#include "hal_mock.h"
+#include "wemos_d1_mini.h"
+
+
+#define NUM_PINS 17
+
+
+struct hal_mock_counters hal_mock_counters;
+
+static bool pin_levels[NUM_PINS];
+static uint16_t sr_val;
+// model time since start, which unlike model_ns isn't reset
+static uint64_t clock_ns;
+// clock_ns at which an asynchronous SPI word is done shifting
+static uint64_t sr_busy_until_ns;
+
+// where eink.c puts CKV and OE: CKV is control bit 4, in the shift
+// register's high byte, and OE has a pin of its own
+#define MOCK_SR_CKV (1 << 12)
+#define MOCK_PIN_OE PIN_D3
+
+static bool ckv_high;
+static bool ckv_pulse_driven;
+
+
+void hal_mock_reset_counters(void)
+{
+    memset(&hal_mock_counters, 0, sizeof(hal_mock_counters));
+}
+
+static void advance(uint64_t ns)
+{
+    hal_mock_counters.model_ns += ns;
+    clock_ns += ns;
+}
+
+static void add_delay(uint64_t ns)
+{
+    hal_mock_counters.delay_ns += ns;
+    advance(ns);
+}
+
+
+// counts CKV pulses after any change to the shift register or pins
+static void watch_ckv(void)
+{
+    const bool ckv = sr_val & MOCK_SR_CKV;
+    if (ckv && !ckv_high) {
+        ++hal_mock_counters.ckv_pulses;
+        ckv_pulse_driven = false;
+    }
+    if (ckv && pin_levels[MOCK_PIN_OE] && !ckv_pulse_driven) {
+        ++hal_mock_counters.ckv_driven_pulses;
+        ckv_pulse_driven = true;
+    }
+    ckv_high = ckv;
+}
+
+
+bool eink_hal_sr_setup(void)
+{
+    sr_val = 0;
+    sr_busy_until_ns = clock_ns;
+    return true;
+}
+
+void eink_hal_sr_wait(void)
+{
+    if (clock_ns < sr_busy_until_ns) {
+        advance(sr_busy_until_ns - clock_ns);
+    }
+}
+
+void eink_hal_sr_start(uint16_t val)
+{
+    eink_hal_sr_wait();
+    sr_val = val;
+    watch_ckv();
+    ++hal_mock_counters.spi_words;
+    advance(MOCK_SPI_START_NS);
+    sr_busy_until_ns = clock_ns + MOCK_SPI_SHIFT_NS;
+}
+
+void eink_hal_sr_write(uint16_t val)
+{
+    eink_hal_sr_wait();
+    sr_val = val;
+    watch_ckv();
+    ++hal_mock_counters.spi_words;
+    advance(MOCK_SPI_WORD_NS);
+}
+
+void eink_hal_pin_setup(uint8_t pin)
+{
+    pin_levels[pin] = false;
+}
+
+void eink_hal_pin_write(uint8_t pin, bool val)
+{
+    ++hal_mock_counters.pin_writes;
+    if (pin_levels[pin] != val) {
+        ++hal_mock_counters.pin_toggles;
+    }
+    pin_levels[pin] = val;
+    watch_ckv();
+    advance(MOCK_PIN_WRITE_NS);
+}
+
+void eink_hal_pins_set(uint32_t gpio_mask)
+{
+    ++hal_mock_counters.pin_writes;
+    for (int pin = 0; pin < NUM_PINS; ++pin) {
+        if ((gpio_mask & (1 << pin)) && !pin_levels[pin]) {
+            ++hal_mock_counters.pin_toggles;
+            pin_levels[pin] = true;
+        }
+    }
+    watch_ckv();
+    advance(MOCK_PIN_WRITE_NS);
+}
+
+void eink_hal_pins_clear(uint32_t gpio_mask)
+{
+    ++hal_mock_counters.pin_writes;
+    for (int pin = 0; pin < NUM_PINS; ++pin) {
+        if ((gpio_mask & (1 << pin)) && pin_levels[pin]) {
+            ++hal_mock_counters.pin_toggles;
+            pin_levels[pin] = false;
+        }
+    }
+    watch_ckv();
+    advance(MOCK_PIN_WRITE_NS);
+}
+
+void eink_hal_delay_us(uint32_t us)
+{
+    add_delay((uint64_t)us * 1000);
+}
+
+void eink_hal_sleep_ms(uint32_t ms)
+{
+    add_delay((uint64_t)ms * 1000000);
+}
+
+uint32_t eink_hal_ccount(void)
+{
+    return clock_ns * MOCK_CPU_MHZ / 1000;
+}
+
+void eink_hal_delay_until(uint32_t start, uint32_t cycles)
+{
+    const uint32_t elapsed = eink_hal_ccount() - start;
+    if (elapsed < cycles) {
+        add_delay(((uint64_t)(cycles - elapsed) * 1000 + MOCK_CPU_MHZ - 1)
+            / MOCK_CPU_MHZ);
+    }
+}
+
+uint32_t eink_hal_disable_interrupts(void)
+{
+    return 0;
+}
+
+void eink_hal_restore_interrupts(uint32_t old_interrupts)
+{
+}
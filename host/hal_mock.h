@@ -0,0 +1,42 @@
+#ifndef __HAL_MOCK_H__
+#define __HAL_MOCK_H__
+
+
+#include <stdint.h>
+
+
+// cost model for the ESP8266 backend, in nanoseconds.
+// an SPI word is 16 bits at 10MHz, plus the SDK's spi_transfer_16 overhead.
+#define MOCK_SPI_WORD_NS        2600
+// an asynchronous SPI word: starting it, then shifting it out in the background
+#define MOCK_SPI_START_NS       300
+#define MOCK_SPI_SHIFT_NS       1600
+// a store to a GPIO register, through gpio_write or the set/clear registers
+#define MOCK_PIN_WRITE_NS       50
+// the cycle counter runs at the CPU clock, counting modelled time
+#define MOCK_CPU_MHZ            80
+
+
+struct hal_mock_counters {
+    uint32_t spi_words;
+    // GPIO register writes
+    uint32_t pin_writes;
+    // pin level changes
+    uint32_t pin_toggles;
+    // time requested from the delay functions
+    uint64_t delay_ns;
+    // modelled wall-clock time of everything above
+    uint64_t model_ns;
+    // gate driver clocks (CKV pulses), and those during which the source
+    // drivers' outputs were enabled (OE), which drive a row. skipped rows
+    // must not be among them.
+    uint32_t ckv_pulses;
+    uint32_t ckv_driven_pulses;
+};
+
+extern struct hal_mock_counters hal_mock_counters;
+
+void hal_mock_reset_counters(void);
+
+
+#endif
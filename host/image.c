@@ -0,0 +1,179 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "image.h"
+
+
+// reads the next header number of a netpbm file, skipping comments. p is
+// left after the one whitespace character that ends it.
+static bool read_pbm_number(const uint8_t **p, const uint8_t *end, int *val)
+{
+    while (*p < end && ('#' == **p || isspace(**p))) {
+        if ('#' == **p) {
+            while (*p < end && '\n' != **p) {
+                ++*p;
+            }
+        } else {
+            ++*p;
+        }
+    }
+
+    if (*p == end || !isdigit(**p)) {
+        return false;
+    }
+
+    *val = 0;
+    while (*p < end && isdigit(**p)) {
+        *val = *val * 10 + (**p - '0');
+        ++*p;
+    }
+
+    if (*p == end || !isspace(**p)) {
+        return false;
+    }
+    ++*p;
+    return true;
+}
+
+static size_t image_row_size(const struct image *img)
+{
+    switch (img->format) {
+    case '4':
+        return (img->w + 7) / 8;
+    case '5':
+        return img->w;
+    default:
+        return 3 * (size_t)img->w;
+    }
+}
+
+bool image_load(struct image *img, const char *path)
+{
+    memset(img, 0, sizeof(*img));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+
+    struct stat st;
+    if (0 != fstat(fd, &st) || 0 == st.st_size) {
+        fprintf(stderr, "%s: empty or unreadable\n", path);
+        close(fd);
+        return false;
+    }
+
+    img->map_size = st.st_size;
+    img->map = mmap(NULL, img->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == img->map) {
+        perror(path);
+        img->map = NULL;
+        return false;
+    }
+
+    const uint8_t *p = img->map;
+    const uint8_t *end = p + img->map_size;
+    img->maxval = 1;
+    if (img->map_size < 2 || 'P' != p[0]
+        || ('4' != p[1] && '5' != p[1] && '6' != p[1]))
+    {
+        fprintf(stderr, "%s: not a binary PBM, PGM or PPM file\n", path);
+        goto fail;
+    }
+    img->format = p[1];
+    p += 2;
+
+    if (!read_pbm_number(&p, end, &img->w)
+        || !read_pbm_number(&p, end, &img->h)
+        || ('4' != img->format && !read_pbm_number(&p, end, &img->maxval)))
+    {
+        fprintf(stderr, "%s: bad header\n", path);
+        goto fail;
+    }
+
+    if (img->w <= 0 || img->h <= 0 || img->maxval <= 0 || img->maxval > 255
+        || (size_t)(end - p) / image_row_size(img) < (size_t)img->h)
+    {
+        fprintf(stderr, "%s: truncated or unsupported\n", path);
+        goto fail;
+    }
+
+    img->pixels = p;
+    return true;
+
+fail:
+    image_free(img);
+    return false;
+}
+
+void image_free(struct image *img)
+{
+    if (img->map) {
+        munmap(img->map, img->map_size);
+    }
+    img->map = NULL;
+    img->pixels = NULL;
+}
+
+
+// luma from sRGB-ish samples, in 8 bit fixed point
+#define LUMA_R 77
+#define LUMA_G 150
+#define LUMA_B 29
+
+static void get_grey_span(const struct image *img, int x, int y, int w,
+    uint8_t *grey)
+{
+    const uint8_t *row = img->pixels + y * image_row_size(img);
+    const int maxval = img->maxval;
+
+    switch (img->format) {
+    case '4':
+        for (int i = 0; i < w; ++i) {
+            const bool black = (row[(x + i) / 8] >> (7 - (x + i) % 8)) & 1;
+            grey[i] = black ? 0 : 255;
+        }
+        break;
+
+    case '5':
+        if (255 == maxval) {
+            memcpy(grey, row + x, w);
+            break;
+        }
+        for (int i = 0; i < w; ++i) {
+            grey[i] = (row[x + i] * 255 + maxval / 2) / maxval;
+        }
+        break;
+
+    default:
+        row += 3 * x;
+        for (int i = 0; i < w; ++i, row += 3) {
+            const int luma = (LUMA_R * row[0] + LUMA_G * row[1]
+                + LUMA_B * row[2] + 128) >> 8;
+            grey[i] = (luma * 255 + maxval / 2) / maxval;
+        }
+        break;
+    }
+}
+
+void image_get_grey(const struct image *img, int x, int y, int w, int h,
+    uint8_t *grey)
+{
+    // the part inside the image
+    const int x0 = (x < 0) ? 0 : x;
+    const int x1 = (x + w > img->w) ? img->w : x + w;
+
+    for (int row = 0; row < h; ++row, grey += w) {
+        memset(grey, 255, w);
+        if (y + row < 0 || y + row >= img->h || x0 >= x1) {
+            continue;
+        }
+        get_grey_span(img, x0, y + row, x1 - x0, grey + (x0 - x));
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// a binary PBM (P4), PGM (P5) or PPM (P6) file mapped into memory, with up
+// to 8 bits per sample. pixels are only read, and converted to grey, when
+// asked for, so a large image costs little more than the part that's used.
+struct image {
+    int w;
+    int h;
+    int maxval;
+    // the magic number's digit
+    char format;
+    const uint8_t *pixels;
+    void *map;
+    size_t map_size;
+};
+
+
+bool image_load(struct image *img, const char *path);
+void image_free(struct image *img);
+
+// copies the w x h area at x, y into grey, one byte per pixel from 0 for
+// black to 255 for white. pixels outside the image are white.
+void image_get_grey(const struct image *img, int x, int y, int w, int h,
+    uint8_t *grey);
+
+
+#endif
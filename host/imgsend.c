@@ -0,0 +1,137 @@
+// dithers an image to the device's grey levels and sends it as the whole
+// screen, or saves it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "eink.h"
+#include "chunk.h"
+#include "client.h"
+#include "dither.h"
+#include "frame.h"
+#include "image.h"
+
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: imgsend [-d none|ordered|diffuse] [-o out.pnm]\n"
+        "               [-s host[:port]] [-f | -z] image.pnm\n"
+        "\n"
+        "dithers a PBM, PGM or PPM image to %d grey levels, centred on the\n"
+        "screen and cropped to it, and sends it to a device as new bitmaps.\n"
+        "  -d  how to dither (default diffuse)\n"
+        "  -o  also save the dithered screen\n"
+        "  -s  the device\n"
+        "  -f  send it framed and run-length coded, and reconnect and resume\n"
+        "      if the connection drops\n"
+        "  -z  send it run-length coded\n",
+        NUM_GREY_LEVELS);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    enum DITHER dither = DITHER_DIFFUSE;
+    const char *out_path = NULL;
+    const char *send_addr = NULL;
+    bool encoded = false;
+    bool framed = false;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "d:o:s:fz"))) {
+        switch (opt) {
+        case 'd':
+            if (!dither_parse(optarg, &dither)) {
+                usage();
+            }
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 's':
+            send_addr = optarg;
+            break;
+        case 'f':
+            framed = true;
+            break;
+        case 'z':
+            encoded = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 1 || (!out_path && !send_addr)) {
+        usage();
+    }
+
+    const double start_ms = now_ms();
+
+    struct image img;
+    if (!image_load(&img, argv[optind])) {
+        return 1;
+    }
+
+    struct frame frame;
+    uint8_t *grey = malloc(SCREEN_BITMAP_WIDTH * SCREEN_BITMAP_HEIGHT);
+    if (!grey || !frame_alloc(&frame, SCREEN_BITMAP_WIDTH,
+        SCREEN_BITMAP_HEIGHT))
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    // only the part that's on the screen is read from the file
+    image_get_grey(&img, (img.w - frame.w) / 2, (img.h - frame.h) / 2,
+        frame.w, frame.h, grey);
+    const bool ok = dither_grey(&frame, grey, dither);
+    free(grey);
+    image_free(&img);
+    if (!ok) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    fprintf(stderr, "prepared in %.3fms\n", now_ms() - start_ms);
+
+    if (out_path && !frame_save_pnm(&frame, out_path)) {
+        return 1;
+    }
+
+    if (send_addr) {
+        const double send_ms = now_ms();
+        const struct rect screen = { 0, 0, frame.w, frame.h };
+        bool sent;
+
+        if (framed) {
+            sent = client_send_framed(send_addr, &frame, &screen, 1,
+                client_transfer_id(&frame, &screen, 1), EINK_MODE_FULL,
+                DEFAULT_FRAMED_RETRIES);
+        } else {
+            int sock = client_connect(send_addr);
+            if (sock < 0) {
+                return 1;
+            }
+            sent = client_send_rects(sock, NULL, &frame, &screen, 1,
+                encoded, EINK_MODE_FULL);
+            close(sock);
+        }
+        if (!sent) {
+            fprintf(stderr, "sending failed\n");
+            return 1;
+        }
+        fprintf(stderr, "sent and drawn in %.3fms\n", now_ms() - send_ms);
+    }
+
+    frame_free(&frame);
+    return 0;
+}
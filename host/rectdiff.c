@@ -0,0 +1,130 @@
+// finds the rectangles that differ between two frames, and optionally sends
+// them to a device.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "eink.h"
+#include "client.h"
+#include "dirty.h"
+#include "frame.h"
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: rectdiff [-c rect_cost] [-s host[:port]] [-f | -n] [-p | -q] [-z]\n"
+        "                old.pnm new.pnm\n"
+        "\n"
+        "prints the rectangles that cover the differences between two\n"
+        "frames as 'x y w h' lines.\n"
+        "  -c  cost of a rectangle in bytes when merging (default %d)\n"
+        "  -s  also send the rectangles to a device\n"
+        "  -f  send them framed, with only the new bitmaps, and reconnect and\n"
+        "      resume if the connection drops\n"
+        "  -n  send only the new bitmaps, using the device's copy of the old\n"
+        "  -p  draw them without driving pixels that don't change\n"
+        "  -q  draw them with the fast waveform, which only drives pixels that\n"
+        "      change, to black or white\n"
+        "  -z  send them run-length coded\n",
+        DEFAULT_RECT_COST);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int rect_cost = DEFAULT_RECT_COST;
+    const char *send_addr = NULL;
+    bool encoded = false;
+    bool new_only = false;
+    bool framed = false;
+    enum EINK_MODE mode = EINK_MODE_FULL;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "c:s:fnpqz"))) {
+        switch (opt) {
+        case 'c':
+            rect_cost = atoi(optarg);
+            break;
+        case 's':
+            send_addr = optarg;
+            break;
+        case 'f':
+            framed = true;
+            new_only = true;
+            break;
+        case 'n':
+            new_only = true;
+            break;
+        case 'p':
+            mode = EINK_MODE_PARTIAL;
+            break;
+        case 'q':
+            mode = EINK_MODE_FAST;
+            break;
+        case 'z':
+            encoded = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+    }
+
+    struct frame old_frame, new_frame;
+    if (!frame_load_pnm(&old_frame, argv[optind])
+        || !frame_load_pnm(&new_frame, argv[optind + 1]))
+    {
+        return 1;
+    }
+
+    if (old_frame.w != new_frame.w || old_frame.h != new_frame.h) {
+        fprintf(stderr, "frames are different sizes\n");
+        return 1;
+    }
+
+    int num_rects;
+    struct rect *rects = find_dirty_rects(&old_frame, &new_frame, rect_cost,
+        &num_rects);
+    if (!rects) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    long bytes = 0;
+    for (int i = 0; i < num_rects; ++i) {
+        printf("%d %d %d %d\n", rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+        const long size = (long)rects[i].h * BITMAP_ROW_SIZE(rects[i].w);
+        bytes += new_only ? size : 2 * size;
+    }
+    fprintf(stderr, "%d rects, %ld bitmap bytes\n", num_rects, bytes);
+
+    if (send_addr && framed) {
+        if (!client_send_framed(send_addr, &new_frame, rects, num_rects,
+            client_transfer_id(&new_frame, rects, num_rects), mode,
+            DEFAULT_FRAMED_RETRIES))
+        {
+            fprintf(stderr, "sending failed\n");
+            return 1;
+        }
+    } else if (send_addr) {
+        int sock = client_connect(send_addr);
+        if (sock < 0) {
+            return 1;
+        }
+        bool ok = client_send_rects(sock, new_only ? NULL : &old_frame,
+            &new_frame, rects, num_rects, encoded, mode);
+        close(sock);
+        if (!ok) {
+            fprintf(stderr, "sending failed\n");
+            return 1;
+        }
+    }
+
+    free(rects);
+    frame_free(&old_frame);
+    frame_free(&new_frame);
+    return 0;
+}
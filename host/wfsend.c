@@ -0,0 +1,309 @@
+// turns a text description of waveforms into a waveform file for the device
+// (see src/waveform.h), and saves it or sends it to a device.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "eink.h"
+#include "client.h"
+#include "crc32.h"
+#include "waveform.h"
+
+
+static const char *const set_names[WAVEFORM_FILE_SETS] = {
+    "refresh", "full", "fast", "partial",
+};
+
+static const char *const kind_names[NUM_STAGE_KINDS] = {
+    "transition", "grey_bit", "changed",
+};
+
+static const char *const value_names[] = {
+    [PV_NEUTRAL] = "neutral",
+    [PV_BLACK] = "black",
+    [PV_WHITE] = "white",
+    [PV_HIZ] = "hiz",
+};
+
+#define COUNT(x) ((int)(sizeof(x) / sizeof((x)[0])))
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: wfsend -d\n"
+        "       wfsend [-o out.ewf] [-s host[:port]] waveforms.txt\n"
+        "       wfsend -r -s host[:port]\n"
+        "\n"
+        "builds a waveform file for %d bit per pixel devices from lines of\n"
+        "  <refresh|full|fast|partial> <ckv high ns> <ckv low ns>\n"
+        "      <transition|grey_bit|changed> <grey bit>\n"
+        "      <W->W> <W->B> <B->W> <B->B>\n"
+        "where each of the last four is neutral, black, white or hiz. each\n"
+        "waveform's stages are in order; '#' starts a comment. timings are\n"
+        "for the coldest temperature band.\n"
+        "  -d  print the built in waveforms in that form\n"
+        "  -o  save the file\n"
+        "  -s  send it to a device, which stores it and uses it from then on\n"
+        "  -r  have the device go back to its built in waveforms\n",
+        PIXEL_BIT_SIZE);
+    exit(2);
+}
+
+// the index of name in names, or -1
+static int find_name(const char *const *names, int num_names,
+    const char *name)
+{
+    for (int i = 0; i < num_names; ++i) {
+        if (0 == strcmp(name, names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// a whole decimal number from 0 to max, or -1
+static long parse_number(const char *str, long max)
+{
+    char *end;
+    const long n = strtol(str, &end, 10);
+    return (*end || end == str || n < 0 || n > max) ? -1 : n;
+}
+
+static void dump_builtin(void)
+{
+    static uint8_t file[WAVEFORM_FILE_MAX_SIZE];
+    waveform_save_file(file);
+
+    struct waveform_file_header hdr;
+    memcpy(&hdr, file, sizeof(hdr));
+    const uint8_t *p = file + sizeof(hdr);
+
+    printf("# %d bit per pixel; set high_ns low_ns kind grey_bit "
+        "W->W W->B B->W B->B\n", PIXEL_BIT_SIZE);
+    for (int set = 0; set < WAVEFORM_FILE_SETS; ++set) {
+        for (int i = 0; i < hdr.num_stages[set]; ++i) {
+            struct waveform_file_stage fs;
+            memcpy(&fs, p, sizeof(fs));
+            p += sizeof(fs);
+
+            printf("%-8s %5u %5u %-10s %u", set_names[set], fs.ckv_high_ns,
+                fs.ckv_low_ns, kind_names[fs.kind], fs.grey_bit);
+            for (int v = 0; v < 4; ++v) {
+                printf(v < 3 ? " %-7s" : " %s",
+                    value_names[(fs.values >> (6 - 2 * v)) & 3]);
+            }
+            printf("\n");
+        }
+    }
+}
+
+// parses one stage line into *set and *fs. returns false if it's malformed.
+static bool parse_stage(char *line, int *set, struct waveform_file_stage *fs)
+{
+    char *fields[9];
+    int n = 0;
+    for (char *tok = strtok(line, " \t\r\n"); tok && n < COUNT(fields);
+        tok = strtok(NULL, " \t\r\n"))
+    {
+        fields[n++] = tok;
+    }
+    if (n != COUNT(fields) || strtok(NULL, " \t\r\n")) {
+        return false;
+    }
+
+    const long high = parse_number(fields[1], UINT16_MAX);
+    const long low = parse_number(fields[2], UINT16_MAX);
+    const long grey_bit = parse_number(fields[4], UINT8_MAX);
+    const int kind = find_name(kind_names, COUNT(kind_names), fields[3]);
+    *set = find_name(set_names, COUNT(set_names), fields[0]);
+    if (*set < 0 || kind < 0 || high < 0 || low < 0 || grey_bit < 0) {
+        return false;
+    }
+
+    *fs = (struct waveform_file_stage){
+        .ckv_high_ns = high,
+        .ckv_low_ns = low,
+        .kind = kind,
+        .grey_bit = grey_bit,
+    };
+    for (int v = 0; v < 4; ++v) {
+        const int value = find_name(value_names, COUNT(value_names),
+            fields[5 + v]);
+        if (value < 0) {
+            return false;
+        }
+        fs->values |= value << (6 - 2 * v);
+    }
+    return true;
+}
+
+// reads waveforms from a text file into file, and returns its size, or 0 if
+// the text is malformed. the stages aren't checked beyond what fits a file.
+static size_t parse_file(const char *path, uint8_t *file)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return 0;
+    }
+
+    struct waveform_file_stage stages[WAVEFORM_FILE_SETS][WAVEFORM_MAX_STAGES];
+    struct waveform_file_header hdr = {
+        .magic = WAVEFORM_MAGIC,
+        .version = WAVEFORM_VERSION,
+        .pixel_bit_size = PIXEL_BIT_SIZE,
+    };
+
+    char line[256];
+    int line_num = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        ++line_num;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        if (strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+
+        int set;
+        struct waveform_file_stage fs;
+        if (!parse_stage(line, &set, &fs)) {
+            fprintf(stderr, "%s:%d: bad stage\n", path, line_num);
+            ok = false;
+        } else if (hdr.num_stages[set] == WAVEFORM_MAX_STAGES) {
+            fprintf(stderr, "%s:%d: more than %d %s stages\n", path,
+                line_num, WAVEFORM_MAX_STAGES, set_names[set]);
+            ok = false;
+        } else {
+            stages[set][hdr.num_stages[set]++] = fs;
+        }
+    }
+    fclose(fp);
+    if (!ok) {
+        return 0;
+    }
+
+    uint8_t *p = file + sizeof(hdr);
+    for (int set = 0; set < WAVEFORM_FILE_SETS; ++set) {
+        const size_t n = hdr.num_stages[set] * sizeof(stages[set][0]);
+        memcpy(p, stages[set], n);
+        p += n;
+    }
+    const size_t size = p - file;
+
+    // as the header describes: the header up to the CRC, then the stages
+    hdr.crc = crc32_update(0, (const uint8_t *)&hdr,
+        offsetof(struct waveform_file_header, crc));
+    hdr.crc = crc32_update(hdr.crc, file + sizeof(hdr), size - sizeof(hdr));
+    memcpy(file, &hdr, sizeof(hdr));
+    return size;
+}
+
+static bool save_file(const char *path, const uint8_t *file, size_t size)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+
+    const bool ok = 1 == fwrite(file, size, 1, fp);
+    if (0 != fclose(fp) || !ok) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return false;
+    }
+    return true;
+}
+
+static bool send_file(const char *addr, const uint8_t *file, size_t size)
+{
+    const int status = client_send_waveform(addr, file, size);
+    switch (status) {
+    case WAVEFORM_OK:
+        return true;
+    case WAVEFORM_ERR_BAD:
+        fprintf(stderr, "the device can't use the waveforms\n");
+        return false;
+    case WAVEFORM_ERR_FLASH:
+        fprintf(stderr, "the device couldn't store the waveforms\n");
+        return false;
+    default:
+        fprintf(stderr, "sending failed\n");
+        return false;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = NULL;
+    const char *send_addr = NULL;
+    bool dump = false;
+    bool revert = false;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "do:rs:"))) {
+        switch (opt) {
+        case 'd':
+            dump = true;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'r':
+            revert = true;
+            break;
+        case 's':
+            send_addr = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (dump) {
+        if (optind != argc || out_path || send_addr || revert) {
+            usage();
+        }
+        dump_builtin();
+        return 0;
+    }
+
+    if (revert) {
+        if (optind != argc || out_path || !send_addr) {
+            usage();
+        }
+        return send_file(send_addr, NULL, 0) ? 0 : 1;
+    }
+
+    if (argc - optind != 1 || (!out_path && !send_addr)) {
+        usage();
+    }
+
+    static uint8_t file[WAVEFORM_FILE_MAX_SIZE];
+    const size_t size = parse_file(argv[optind], file);
+    if (0 == size) {
+        return 1;
+    }
+    // the same checks the device makes, so a bad file isn't sent
+    if (!waveform_file_check(file, size)) {
+        fprintf(stderr, "%s: the waveforms don't fit the device: each needs "
+            "1 to %d stages with high times, %d at most between the update "
+            "waveforms, refresh stages must be transitions, and grey bits "
+            "must be under %d\n", argv[optind], WAVEFORM_MAX_STAGES,
+            WAVEFORM_MAX_UPDATE_STAGES, PIXEL_BIT_SIZE);
+        return 1;
+    }
+
+    if (out_path && !save_file(out_path, file, size)) {
+        return 1;
+    }
+    if (send_addr && !send_file(send_addr, file, size)) {
+        return 1;
+    }
+    return 0;
+}
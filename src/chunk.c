@@ -0,0 +1,218 @@
+#include "chunk.h"
+#include "shadow.h"
+
+
+struct chunk_buf chunk_bufs[NUM_CHUNK_BUFS];
+
+
+// old pixels at the other end of the grey scale from the w new ones starting
+// at pixel new_x of new_row
+static void opposite_row(uint8_t *old_row, const uint8_t *new_row, int new_x,
+    int w)
+{
+    for (int x = 0; x < w; ++x) {
+        const pixel_t p = get_row_pixel(new_row, new_x + x);
+        set_row_pixel(old_row, x, (p >= NUM_GREY_LEVELS / 2) ? WHITE : BLACK);
+    }
+}
+
+// the start of row y of a chunk's old or new bitmap
+static uint8_t *chunk_row_start(const struct chunk_params *cp,
+    uint8_t *bits, int y)
+{
+    return bits + cp->ofs + (y - cp->y) * cp->byte_w;
+}
+
+// row y of a chunk's old or new bitmap, from pixel x0 to x1. a chunk split
+// by chunk_list_cover can start right of its bitmap, and if that's not on a
+// byte boundary the pixels are shifted into tmp.
+static const uint8_t *chunk_row(const struct chunk_params *cp,
+    uint8_t *bits, int y, int x0, int x1, uint8_t *tmp)
+{
+    const uint8_t *row = chunk_row_start(cp, bits, y);
+    const int dx = x0 - cp->x;
+    if (0 == dx % PIXELS_PER_BYTE) {
+        return row + dx / PIXELS_PER_BYTE;
+    }
+
+    for (int x = 0; x < x1 - x0; ++x) {
+        set_row_pixel(tmp, x, get_row_pixel(row, dx + x));
+    }
+    return tmp;
+}
+
+bool get_rows_from_chunks(void *arg, int y, int x0, int x1,
+    struct eink_row_span *span)
+{
+    struct chunk_params *cp = arg;
+    uint8_t *kept_row = chunk_row_start(cp, cp->buf->old_bits, y);
+    span->new_row = chunk_row_start(cp, cp->buf->new_bits, y);
+    span->new_x = x0 - cp->x;
+
+    if (cp->kept_y0 <= y && y < cp->kept_y1) {
+        span->old_row = kept_row;
+        span->old_x = span->new_x;
+        return true;
+    }
+
+    // what's on the panel beats what the client thinks is on it
+    const uint8_t *row = shadow_get_row(y);
+    if (row) {
+        span->old_row = row;
+        span->old_x = x0;
+    } else if (cp->has_old) {
+        span->old_row = kept_row;
+        span->old_x = span->new_x;
+    } else {
+        opposite_row(span->old_buf, span->new_row, span->new_x, x1 - x0);
+        span->old_row = span->old_buf;
+        span->old_x = 0;
+    }
+
+    // rows come in order within each stage. the client's old pixels are
+    // no longer needed once the first stage has picked the old ones.
+    if (cp->kept_y0 == cp->kept_y1 || y == cp->kept_y1) {
+        if (span->old_row != kept_row) {
+            copy_row_pixels(kept_row, span->new_x, span->old_row,
+                span->old_x, x1 - x0);
+        }
+        if (cp->kept_y0 == cp->kept_y1) {
+            cp->kept_y0 = y;
+        }
+        cp->kept_y1 = y + 1;
+    }
+    return true;
+}
+
+bool get_rows_from_chunk_list(void *arg, int y, int x0, int x1,
+    struct eink_row_span *span)
+{
+    struct chunk_list *cl = arg;
+    for (int i = 0; i < cl->num_chunks; ++i) {
+        const struct eink_region *r = &cl->regions[i];
+        if (r->x0 == x0 && r->y0 <= y && y < r->y1) {
+            return get_rows_from_chunks(&cl->chunks[i], y, x0, x1, span);
+        }
+    }
+    return false;
+}
+
+void chunk_list_drawn(const struct chunk_list *cl, bool completed)
+{
+    uint8_t tmp[MAX_BITMAP_ROW_SIZE];
+
+    // a row at a time, so regions sharing it hit the shadow's cached row
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        for (int i = 0; i < cl->num_chunks; ++i) {
+            const struct eink_region *r = &cl->regions[i];
+            const struct chunk_params *cp = &cl->chunks[i];
+            if (y < r->y0 || y >= r->y1) {
+                continue;
+            }
+
+            if (completed) {
+                shadow_put_span(y, r->x0, r->x1, chunk_row(cp,
+                    cp->buf->new_bits, y, r->x0, r->x1, tmp));
+            } else {
+                shadow_forget_row(y);
+            }
+        }
+    }
+}
+
+
+static bool regions_overlap(const struct eink_region *a,
+    const struct eink_region *b)
+{
+    return a->x0 < b->x1 && b->x0 < a->x1 && a->y0 < b->y1 && b->y0 < a->y1;
+}
+
+// the parts of r outside cut: the rows above and below it, then the parts
+// left and right of it in the rows they share. returns how many.
+static int split_region(const struct eink_region *r,
+    const struct eink_region *cut, struct eink_region *pieces)
+{
+    if (!regions_overlap(r, cut)) {
+        pieces[0] = *r;
+        return 1;
+    }
+
+    int n = 0;
+    const int y0 = (cut->y0 > r->y0) ? cut->y0 : r->y0;
+    const int y1 = (cut->y1 < r->y1) ? cut->y1 : r->y1;
+
+    if (r->y0 < y0) {
+        pieces[n++] = (struct eink_region){ r->x0, r->y0, r->x1, y0 };
+    }
+    if (y1 < r->y1) {
+        pieces[n++] = (struct eink_region){ r->x0, y1, r->x1, r->y1 };
+    }
+    if (r->x0 < cut->x0) {
+        pieces[n++] = (struct eink_region){ r->x0, y0, cut->x0, y1 };
+    }
+    if (cut->x1 < r->x1) {
+        pieces[n++] = (struct eink_region){ cut->x1, y0, r->x1, y1 };
+    }
+    return n;
+}
+
+int chunk_list_count_cover(const struct chunk_list *cl,
+    const struct eink_region *region)
+{
+    struct eink_region pieces[4];
+    int n = 0;
+    for (int i = 0; i < cl->num_chunks; ++i) {
+        n += split_region(&cl->regions[i], region, pieces);
+    }
+    return n;
+}
+
+void chunk_list_cover(struct chunk_list *cl, const struct eink_region *region)
+{
+    // drop the chunks region covers completely first, so the pieces of the
+    // rest fit in the arrays as they're added
+    struct eink_region pieces[4];
+    int n = 0;
+    for (int i = 0; i < cl->num_chunks; ++i) {
+        if (split_region(&cl->regions[i], region, pieces) > 0) {
+            cl->regions[n] = cl->regions[i];
+            cl->chunks[n] = cl->chunks[i];
+            ++n;
+        }
+    }
+    cl->num_chunks = n;
+
+    // the pieces of a split chunk keep its bitmap, starting at their own rows
+    for (int i = 0; i < n; ++i) {
+        if (!regions_overlap(&cl->regions[i], region)) {
+            continue;
+        }
+
+        const struct chunk_params cp = cl->chunks[i];
+        const int num_pieces = split_region(&cl->regions[i], region, pieces);
+        for (int j = 0; j < num_pieces; ++j) {
+            const int k = (0 == j) ? i : cl->num_chunks++;
+            cl->regions[k] = pieces[j];
+            cl->chunks[k] = cp;
+            cl->chunks[k].y = pieces[j].y0;
+            cl->chunks[k].ofs = cp.ofs + (pieces[j].y0 - cp.y) * cp.byte_w;
+        }
+    }
+}
+
+enum RECT_STATUS chunk_check_rect(const struct rect_header *rh)
+{
+    // the far edges are compared by subtracting, as adding could overflow
+    if (rh->x < 0 || rh->y < 0 || rh->w < 0 || rh->h < 0
+        || rh->w > SCREEN_BITMAP_WIDTH - rh->x
+        || rh->h > SCREEN_BITMAP_HEIGHT - rh->y)
+    {
+        return RECT_ERR_BOUNDS;
+    }
+
+    if (rh->w > 0 && rh->h > CHUNK_BUF_SIZE / BITMAP_ROW_SIZE(rh->w)) {
+        return RECT_ERR_SIZE;
+    }
+
+    return RECT_OK;
+}
@@ -0,0 +1,113 @@
+#ifndef __CHUNK_H__
+#define __CHUNK_H__
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "eink.h"
+#include "protocol.h"
+
+
+// a full frame buffer is 60KB, but we don't have that much available RAM on
+// the ESP8266, so we get it in chunks
+#define SCREEN_BITMAP_WIDTH 800
+#define SCREEN_BITMAP_HEIGHT 600
+#define SCREEN_BITMAP_X_OFS 0
+#define SCREEN_BITMAP_Y_OFS 0
+// tiles shrink with deeper pixels so the chunk bitmaps stay about 5KB each
+#if PIXEL_BIT_SIZE == 1
+#define CHUNK_WIDTH 205
+#define CHUNK_HEIGHT 205
+#elif PIXEL_BIT_SIZE == 2
+#define CHUNK_WIDTH 165
+#define CHUNK_HEIGHT 125
+#else
+#define CHUNK_WIDTH 125
+#define CHUNK_HEIGHT 80
+#endif
+#define CHUNK_OVERLAP 5
+
+// chunk bitmaps are stored as rows of byte_w bytes, so any rectangle with
+// byte_w * h up to CHUNK_BUF_SIZE fits, not just CHUNK_WIDTH x CHUNK_HEIGHT
+#define CHUNK_BUF_SIZE (CHUNK_HEIGHT * BITMAP_ROW_SIZE(CHUNK_WIDTH))
+
+struct chunk_buf {
+    uint8_t old_bits[CHUNK_BUF_SIZE];
+    uint8_t new_bits[CHUNK_BUF_SIZE];
+};
+
+// two, so one can be received into while the other is drawn.
+// RAM: these, the shadow pool and the update LUTs are the driver's big
+// buffers, and are kept to 40KB between them at any PIXEL_BIT_SIZE. that's
+// meant to leave about half the ESP8266's 80KB of data RAM to the SDK, WiFi
+// and lwIP; the device prints its free heap once it's listening, and
+// reports it in PROTO_CMD_STATS, to check that on a board.
+#define NUM_CHUNK_BUFS 2
+
+extern struct chunk_buf chunk_bufs[NUM_CHUNK_BUFS];
+
+
+struct chunk_params {
+    struct chunk_buf *buf;
+    // whether the client sent old rows. they're only used for rows the
+    // shadow doesn't know.
+    bool has_old;
+    // where the bitmap's first row and column are on the screen. the
+    // chunk's region starts there, or to the right of it once
+    // chunk_list_cover has split the chunk.
+    int x;
+    int y;
+    int byte_w;
+    // where the chunk's rows start in buf
+    int ofs;
+    // rows whose old pixels have been copied into buf's old bitmap, from
+    // wherever they came from, for the later stages of the update drawing
+    // them. zero for a chunk that hasn't been drawn.
+    int kept_y0;
+    int kept_y1;
+};
+
+// chunks packed into chunk buffers, to be drawn together with
+// eink_update_regions. chunks[i] holds the bitmaps of regions[i].
+struct chunk_list {
+    int num_chunks;
+    struct eink_region regions[EINK_MAX_REGIONS];
+    struct chunk_params chunks[EINK_MAX_REGIONS];
+};
+
+// get_row_span_cb_t that points at new rows in a chunk buffer, and old rows
+// in the shadow, or the chunk buffer if the shadow doesn't know them. arg is
+// a struct chunk_params describing where the chunk is, in the buffer and on
+// the screen.
+// with neither, old pixels are taken to be at the far end from the new ones,
+// which drives every pixel all the way.
+// the old pixels of each row are kept in the chunk buffer's old bitmap the
+// first time it's asked for, so later stages don't decode the shadow again.
+// a chunk can only be drawn once.
+bool get_rows_from_chunks(void *arg, int y, int x0, int x1,
+    struct eink_row_span *span);
+
+// like get_rows_from_chunks, for the regions of a struct chunk_list
+bool get_rows_from_chunk_list(void *arg, int y, int x0, int x1,
+    struct eink_row_span *span);
+
+// records the new rows of a drawn chunk list in the shadow. if drawing
+// didn't complete, forgets them instead.
+void chunk_list_drawn(const struct chunk_list *cl, bool completed);
+
+// a newer chunk is about to be added over region: drops the parts of cl's
+// chunks that it covers. chunks it partly covers are split into up to 4
+// pieces, which keep their part of the chunk's bitmap in place.
+void chunk_list_cover(struct chunk_list *cl, const struct eink_region *region);
+
+// how many chunks cl would have after chunk_list_cover
+int chunk_list_count_cover(const struct chunk_list *cl,
+    const struct eink_region *region);
+
+// whether a rectangle a client sent fits on the screen, and its bitmaps in a
+// chunk buffer. the header comes off the network, so any values at all are
+// checked without overflowing.
+enum RECT_STATUS chunk_check_rect(const struct rect_header *rh);
+
+
+#endif
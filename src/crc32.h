@@ -0,0 +1,17 @@
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+
+// the CRC-32 of zlib and ethernet, for checking framed chunks on the wire
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// continues crc, the CRC of the data before, over size more bytes. start
+// with 0.
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
+
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "eink.h"
+#include "display.h"
+#include "ghost.h"
+#include "perf.h"
+#include "shadow.h"
+
+
+struct display_job display_jobs[NUM_DISPLAY_JOBS];
+
+// jobs to draw, and jobs drawn, in order
+static QueueHandle_t draw_queue;
+static QueueHandle_t drawn_queue;
+
+
+// runs an op a row at a time, so the network side gets to run between rows
+// rather than only when the tick preempts us
+static void run_op(struct eink_op *op)
+{
+    while (eink_step(op)) {
+        taskYIELD();
+    }
+}
+
+// static rather than on the task's small stack
+static struct eink_region clean_regions[EINK_MAX_REGIONS];
+
+// redraws the cells that fast updates have taken over budget with a full
+// update of what the shadow says is there
+static void clean_ghosts(int budget)
+{
+    const int n = ghost_clean_regions(budget, clean_regions);
+    if (0 == n) {
+        return;
+    }
+
+    struct eink_op op;
+    eink_update_spans_begin(&op, EINK_MODE_FULL, shadow_get_rows, NULL,
+        clean_regions, n);
+    run_op(&op);
+
+    if (eink_op_completed(&op)) {
+        ghost_drawn(EINK_MODE_FULL, clean_regions, n);
+    }
+    perf_count(PERF_GHOST_CLEANS, 1);
+}
+
+static void draw_chunks(struct display_job *job)
+{
+    struct eink_op op;
+    eink_update_spans_begin(&op, job->mode, get_rows_from_chunk_list,
+        &job->list, job->list.regions, job->list.num_chunks);
+    run_op(&op);
+
+    const bool completed = eink_op_completed(&op);
+    chunk_list_drawn(&job->list, completed);
+
+    // a fast or partial update stopped part way has still driven some of
+    // its pixels
+    if (completed || EINK_MODE_FULL != job->mode) {
+        ghost_drawn(job->mode, job->list.regions, job->list.num_chunks);
+    }
+
+    // cleans normally wait for the client to go quiet, but one streaming
+    // fast or partial updates might never do that
+    if (ghost_over(GHOST_HARD_BUDGET)) {
+        clean_ghosts(GHOST_BUDGET);
+    }
+}
+
+static void display_thread(void *arg)
+{
+    for (;;) {
+        struct display_job *job;
+        if (pdTRUE != xQueueReceive(draw_queue, &job, portMAX_DELAY))
+            continue;
+
+        if (job->clean) {
+            clean_ghosts(GHOST_BUDGET);
+        } else if (job->waveform) {
+            // between ops, so no update sees its waveforms change under it
+            eink_load_waveforms(job->size ? job->buf->new_bits : NULL,
+                job->size);
+        } else {
+            draw_chunks(job);
+        }
+
+        xQueueSend(drawn_queue, &job, portMAX_DELAY);
+    }
+}
+
+bool display_setup(void)
+{
+    for (int i = 0; i < NUM_DISPLAY_JOBS; ++i) {
+        display_jobs[i].buf = &chunk_bufs[i];
+    }
+
+    draw_queue = xQueueCreate(NUM_DISPLAY_JOBS, sizeof(struct display_job*));
+    drawn_queue = xQueueCreate(NUM_DISPLAY_JOBS, sizeof(struct display_job*));
+    if (!draw_queue || !drawn_queue) {
+        printf("error creating display queues\n");
+        return false;
+    }
+
+    // same priority as the network side: drawing busy-waits on the panel
+    // within each row, so a higher priority would starve receiving. it
+    // yields between rows instead. WiFi itself is handled by higher priority
+    // SDK tasks.
+    int err = xTaskCreate(display_thread, "display", 512, NULL, 1, NULL);
+    if (pdPASS != err) {
+        printf("error creating display thread: %d\n", err);
+        return false;
+    }
+
+    return true;
+}
+
+void display_draw_job(struct display_job *job)
+{
+    xQueueSend(draw_queue, &job, portMAX_DELAY);
+}
+
+struct display_job *display_wait_drawn(TickType_t wait)
+{
+    struct display_job *job;
+    if (pdTRUE != xQueueReceive(drawn_queue, &job, wait))
+        return NULL;
+    return job;
+}
@@ -0,0 +1,54 @@
+#ifndef __DISPLAY_H__
+#define __DISPLAY_H__
+
+
+// the display task draws batches of chunks handed to it by the network side,
+// so the next batch can be received while the panel is busy with this one.
+
+
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "chunk.h"
+
+
+// a batch of chunks in one chunk buffer, drawn with one eink_update_regions
+struct display_job {
+    struct chunk_buf *buf;
+    struct chunk_list list;
+    // rectangles received into the job. once later ones replace parts of
+    // earlier ones, that's not the number of chunks in list.
+    int num_rects;
+    // for PROTO_CMD_FRAMED, the seq of the first of them; the rest follow
+    bool framed;
+    uint32_t first_seq;
+    enum EINK_MODE mode;
+    // instead of drawing chunks, clean the cells that fast and partial
+    // updates have taken over GHOST_BUDGET
+    bool clean;
+    // instead of drawing chunks, switch to the waveform file of size bytes
+    // in buf's new_bits, or to the built in waveforms if size is 0
+    bool waveform;
+    // bytes of each of buf's bitmaps used by the chunks in list, including
+    // ones that later chunks replaced
+    int size;
+};
+
+#define NUM_DISPLAY_JOBS NUM_CHUNK_BUFS
+
+// one job per chunk buffer. jobs not passed to display_draw_job are the
+// caller's to fill.
+extern struct display_job display_jobs[NUM_DISPLAY_JOBS];
+
+
+bool display_setup(void);
+
+// queues a job to be drawn. the caller mustn't touch it until
+// display_wait_drawn gives it back.
+void display_draw_job(struct display_job *job);
+
+// waits up to wait ticks for the oldest queued job to be drawn, and returns
+// it, or NULL if it's still being drawn
+struct display_job *display_wait_drawn(TickType_t wait);
+
+
+#endif
@@ -1,18 +1,11 @@
-#include "espressif/esp_common.h"
-#include "espressif/esp_misc.h"
 #include <string.h>
-#include "esp/gpio.h"
-#include "esp/spi.h"
-#include "esp/interrupts.h"
 #include "wemos_d1_mini.h"
 #include "eink.h"
+#include "eink_hal.h"
+#include "perf.h"
 #include "waveform.h"
 
 
-// SPI used for shift register
-#define SR_SPI 1
-
-
 // pins not included in shift registers:
 #define PIN_SR_N_OE     PIN_D4      // shift register not-output-enable
 #define PIN_CL          PIN_D2      // horizontal clock
@@ -55,32 +48,68 @@ static uint8_t eink_data_byte;
 #define CLEAR_WRITE_TIME_NS     5000
 
 
+// waits at least ms, letting other tasks run
 static void delay_ms(uint32_t ms)
 {
-    for (int i = 0; i < ms; ++i) {
-        sdk_os_delay_us(1000);
-    }
+    eink_hal_sleep_ms(ms);
 }
 
+// spins, for waits that need to be close to what's asked
 static void delay_us(uint32_t us)
 {
-    delay_ms(us / 1000);
-    sdk_os_delay_us(us % 1000);
+    // the SDK's delay only takes 16 bits
+    for (; us >= 1000; us -= 1000) {
+        eink_hal_delay_us(1000);
+    }
+    eink_hal_delay_us(us);
+}
+
+
+// cycle counter rate, found by calibrate_timing
+static uint32_t cycles_per_us = 80;
+// cycles a shift register write takes to reach the outputs, which is where
+// high() and low() change an SR pin
+static uint32_t sr_write_cycles;
+
+// calibration, and the worst CKV pulses since eink_get_timing
+static struct eink_timing timing;
+
+static inline uint32_t ns_to_cycles(uint32_t ns)
+{
+    return (ns * cycles_per_us + 999) / 1000;
 }
 
-// TODO: only good for 50ns+, and ignores function call time
-static inline void delay_25ns_steps(int steps)
+static inline uint32_t cycles_to_ns(uint32_t cycles)
 {
-    // at 80MHz, each cycle is 12.5ns, so 2 cycles are 25ns (1 step).
-    // TODO: this naively assumes that each instruction is 1 cycle.
-    register int i;
-    __asm__ __volatile__ (
-            "nop\n"
-            "addi  %0, %1, -1\n"
-        "0:\n"
-            "addi  %0, %0, -1\n"
-            "bgez  %0, 0b\n"
-        : "=r"(i) : "r"(steps));
+    return cycles * 1000 / cycles_per_us;
+}
+
+// keeps the pulse that came out furthest over what it asked for
+static void record_pulse(uint32_t *worst_ns, uint32_t *worst_requested_ns,
+    uint32_t cycles, uint32_t requested_ns)
+{
+    const uint32_t ns = cycles_to_ns(cycles);
+    if (0 == *worst_requested_ns || (int32_t)(ns - requested_ns)
+        > (int32_t)(*worst_ns - *worst_requested_ns))
+    {
+        *worst_ns = ns;
+        *worst_requested_ns = requested_ns;
+    }
+}
+
+// waits so that an SR pin changed next changes ns after edge, the cycle
+// count just after the last change
+static inline void delay_sr_edge(uint32_t edge, uint32_t ns)
+{
+    const uint32_t cycles = ns_to_cycles(ns);
+    eink_hal_delay_until(edge,
+        (cycles > sr_write_cycles) ? cycles - sr_write_cycles : 0);
+}
+
+// same for a pin outside the SR, which changes as soon as it's written
+static inline void delay_extra_edge(uint32_t edge, uint32_t ns)
+{
+    eink_hal_delay_until(edge, ns_to_cycles(ns));
 }
 
 
@@ -93,20 +122,42 @@ static inline uint16_t make_sr_val(uint16_t ctl, uint8_t data_byte)
 // updates shift register only, not extra control pins
 static void update_sr(void)
 {
-    spi_transfer_16(SR_SPI, make_sr_val(eink_ctl, eink_data_byte));
+    eink_hal_sr_write(make_sr_val(eink_ctl, eink_data_byte));
 }
 
-// updates extra control pins
-static void update_extra(void)
+// GPIO register bits of the extra control pins
+#define GPIO_CL         (1 << PIN_CL)
+#define GPIO_OE         (1 << PIN_OE)
+
+// extra control bits as last written to their pins
+static uint16_t extra_pins;
+
+static inline uint32_t extra_gpio_bits(uint16_t ctl)
+{
+    return ((ctl & BIT_CL) ? GPIO_CL : 0) | ((ctl & BIT_OE) ? GPIO_OE : 0);
+}
+
+// updates extra control pins, writing only the ones that changed
+static inline void update_extra(void)
 {
-    gpio_write(PIN_CL, (eink_ctl & BIT_CL) ? 1 : 0);
-    gpio_write(PIN_OE, (eink_ctl & BIT_OE) ? 1 : 0);
+    const uint16_t changed = (eink_ctl ^ extra_pins) & EXTRA_BITS_MASK;
+    if (changed & eink_ctl) {
+        eink_hal_pins_set(extra_gpio_bits(changed & eink_ctl));
+    }
+    if (changed & ~eink_ctl) {
+        eink_hal_pins_clear(extra_gpio_bits(changed & ~eink_ctl));
+    }
+    extra_pins = eink_ctl & EXTRA_BITS_MASK;
 }
 
 static void update_ctl(void)
 {
     update_sr();
-    update_extra();
+
+    // we don't know what the extra pins are at, so write all of them
+    eink_hal_pins_set(extra_gpio_bits(eink_ctl));
+    eink_hal_pins_clear(extra_gpio_bits(~eink_ctl));
+    extra_pins = eink_ctl & EXTRA_BITS_MASK;
 }
 
 static inline void low(uint16_t pins)
@@ -130,6 +181,8 @@ static inline void high(uint16_t pins)
 
 void eink_power_on(void)
 {
+    const uint32_t start = perf_start();
+
     // clear everything (turning SMPS on), clear VNEG & VPOS
     eink_ctl = 0;
     update_ctl();
@@ -142,6 +195,8 @@ void eink_power_on(void)
 
     delay_us(10);
     high(BIT_SPV|BIT_SPH);
+
+    perf_record(PERF_POWER_ON, start);
 }
 
 void eink_power_off(void)
@@ -160,11 +215,24 @@ void eink_power_off(void)
 }
 
 
+// one horizontal clock. CL is only ever raised here, so it starts low and
+// doesn't need to go through eink_ctl.
+static inline void cl_pulse(void)
+{
+    eink_hal_pins_set(GPIO_CL);
+    eink_hal_pins_clear(GPIO_CL);
+}
+
 static void hclk(int n)
 {
-    for (int i = 0; i < n; ++i) {
-        high(BIT_CL);
-        low(BIT_CL);
+    for (; n >= 4; n -= 4) {
+        cl_pulse();
+        cl_pulse();
+        cl_pulse();
+        cl_pulse();
+    }
+    for (; n > 0; --n) {
+        cl_pulse();
     }
 }
 
@@ -182,7 +250,7 @@ static void data_write(uint8_t b)
         eink_data_byte = b;
         update_sr();
     }
-    hclk(1);
+    cl_pulse();
 }
 
 static void hscan_stop(void)
@@ -205,37 +273,65 @@ static void hscan_solid_row(int pixel_val)
 }
 
 
+// CKV high and low times while clocking the gate drivers to the first row
+#define VCLK_DELAY_NS   30000
+
 static void vclk(int n)
 {
     for (int i = 0; i < n; ++i) {
         low(BIT_CKV);
-        delay_25ns_steps(60*20);
+        delay_sr_edge(eink_hal_ccount(), VCLK_DELAY_NS);
         high(BIT_CKV);
-        delay_25ns_steps(60*20);
+        delay_sr_edge(eink_hal_ccount(), VCLK_DELAY_NS);
     }
 }
 
 // delays in nanoseconds
 static void vscan_write(uint32_t ckv_high_delay, uint32_t ckv_low_delay)
 {
-    uint32_t high_steps = (ckv_high_delay + 24) / 25;
-    uint32_t low_steps = (ckv_low_delay + 24) / 25;
-
-    // don't let interrupts affect timing
-    uint32_t old_interrupts = _xt_disable_interrupts();
+    // don't let interrupts stretch the CKV pulse, which is what drives the
+    // row. a longer low time only delays the next row, so interrupts are
+    // let in for it.
+    uint32_t old_interrupts = eink_hal_disable_interrupts();
 
     high(BIT_OE|BIT_CKV);
-    delay_25ns_steps(high_steps);
+    const uint32_t high_edge = eink_hal_ccount();
+    delay_sr_edge(high_edge, ckv_high_delay);
     low(BIT_CKV);
-    delay_25ns_steps(low_steps);
+    const uint32_t low_edge = eink_hal_ccount();
+
+    eink_hal_restore_interrupts(old_interrupts);
+
+    delay_extra_edge(low_edge, ckv_low_delay);
     low(BIT_OE);
+    const uint32_t end = eink_hal_ccount();
 
-    _xt_restore_interrupts(old_interrupts);
+    record_pulse(&timing.ckv_high_ns, &timing.ckv_high_requested_ns,
+        low_edge - high_edge, ckv_high_delay);
+    record_pulse(&timing.ckv_low_ns, &timing.ckv_low_requested_ns,
+        end - low_edge, ckv_low_delay);
 
     hclk(2);
 }
 
 
+// clocks the gate drivers past n rows without driving them: CKV pulses as
+// short as the shift register allows, with the source drivers' outputs off.
+// OE must be low, which it is between vscan_write and the next row's
+// hscan_start, so skips have to come before the next row is sent.
+static void vscan_skip(int n)
+{
+    const uint16_t ckv_high = make_sr_val(eink_ctl | BIT_CKV, eink_data_byte);
+    const uint16_t ckv_low = make_sr_val(eink_ctl & ~BIT_CKV, eink_data_byte);
+
+    for (int i = 0; i < n; ++i) {
+        eink_hal_sr_start(ckv_high);
+        eink_hal_sr_start(ckv_low);
+    }
+    eink_hal_sr_wait();
+}
+
+
 static void vscan_start(void)
 {
     high(BIT_GMODE);
@@ -266,142 +362,665 @@ static void vscan_stop(void)
 }
 
 
-// do one stage of updating old row -> new_row
-static void do_row_update_stage(int x0, int x1,
-    uint8_t *old_row, uint8_t *new_row, int wf_stage)
+// the update waveforms compiled into drive values: for each stage, maps a
+// nibble of the old bitmap (high nibble of the index) and the same nibble of
+// the new bitmap (low nibble) to the 2 bit values that drive its pixels,
+// leftmost pixel in the MSB. with 1 bit pixels that's a whole drive byte;
+// deeper pixels take PIXEL_BIT_SIZE lookups per byte.
+// the modes' stages are stored one after the other, up to
+// WAVEFORM_MAX_STAGES each and WAVEFORM_MAX_UPDATE_STAGES in all.
+#define MAX_UPDATE_STAGES WAVEFORM_MAX_STAGES
+#define MAX_UPDATE_LUTS WAVEFORM_MAX_UPDATE_STAGES
+#define PIXELS_PER_NIBBLE (4 / PIXEL_BIT_SIZE)
+#define LUT_VALUE_BITS (2 * PIXELS_PER_NIBBLE)
+static uint8_t update_luts[MAX_UPDATE_LUTS][256];
+static int first_update_lut[NUM_EINK_MODES];
+static int num_update_stages[NUM_EINK_MODES];
+// whether a mode leaves every pixel that doesn't change neutral in every
+// stage, so rows where nothing changes needn't be driven at all
+static bool only_drives_changes[NUM_EINK_MODES];
+
+// bitmap bits behind one drive byte
+#define DRIVE_BITMAP_BITS (PVS_PER_IO_BYTE * PIXEL_BIT_SIZE)
+#define DRIVE_BITMAP_MASK ((1 << DRIVE_BITMAP_BITS) - 1)
+
+// drive byte masks for pixel groups cut by the region's x0/x1, indexed by
+// x0 % 4 and x1 % 4
+static const uint8_t left_edge_masks[PVS_PER_IO_BYTE] = {
+    0xff, 0x3f, 0x0f, 0x03
+};
+static const uint8_t right_edge_masks[PVS_PER_IO_BYTE] = {
+    0xff, 0xc0, 0xf0, 0xfc
+};
+
+// drive bytes for one row, leftmost pixel group first
+static uint8_t drive_row[SCREEN_WIDTH / PVS_PER_IO_BYTE];
+
+
+// compiles one stage of mode's update waveform into lut
+static void build_update_lut(enum EINK_MODE mode, int stage, uint8_t *lut)
 {
-    hscan_start();
+    for (int idx = 0; idx < 256; ++idx) {
+        const uint8_t old_bits = idx >> 4;
+        const uint8_t new_bits = idx & 0xf;
 
-    for (int x = 0; x < SCREEN_WIDTH; x += PVS_PER_IO_BYTE) {
-        // build data byte from pixel values
         uint8_t val = 0;
-        for (int i = 0; i < PVS_PER_IO_BYTE; ++i) {
-            int xi = x + i;
-
-            int pixel_val;
-
-            if (x0 <= xi && xi < x1) {
-                pixel_t old_pixel = get_row_pixel(old_row, xi - x0);
-                pixel_t new_pixel = get_row_pixel(new_row, xi - x0);
-                pixel_val = get_update_waveform_value(wf_stage,
-                    old_pixel, new_pixel);
-            } else {
-                pixel_val = PV_NEUTRAL;
-            }
+        for (int i = 0; i < PIXELS_PER_NIBBLE; ++i) {
+            const int bit_index = (PIXELS_PER_NIBBLE - 1 - i)
+                * PIXEL_BIT_SIZE;
+            pixel_t old_pixel = (old_bits >> bit_index) & PIXEL_BITMASK;
+            pixel_t new_pixel = (new_bits >> bit_index) & PIXEL_BITMASK;
 
             val <<= 2;
-            val |= pixel_val;
+            val |= get_update_waveform_value(mode, stage,
+                old_pixel, new_pixel);
         }
 
-        data_write(val);
+        lut[idx] = val;
     }
+}
 
-    hscan_stop();
+static void build_update_luts(void)
+{
+    int num_luts = 0;
+    for (int mode = 0; mode < NUM_EINK_MODES; ++mode) {
+        first_update_lut[mode] = num_luts;
+        num_update_stages[mode] = 0;
+
+        uint32_t ckv_high_delay_ns;
+        uint32_t ckv_low_delay_ns;
+        for (int stage = 0; stage < MAX_UPDATE_STAGES
+            && num_luts < MAX_UPDATE_LUTS; ++stage)
+        {
+            get_update_waveform_timings(mode, TEMP_BAND_COLD, stage,
+                &ckv_high_delay_ns, &ckv_low_delay_ns);
+            if (0 == ckv_high_delay_ns) {
+                break;
+            }
+
+            build_update_lut(mode, stage, update_luts[num_luts++]);
+            ++num_update_stages[mode];
+        }
+
+        only_drives_changes[mode] = true;
+        for (int i = first_update_lut[mode]; i < num_luts; ++i) {
+            // old and new nibbles the same. PV_NEUTRAL is 0.
+            for (int bits = 0; bits < 16; ++bits) {
+                if (0 != update_luts[i][(bits << 4) | bits]) {
+                    only_drives_changes[mode] = false;
+                }
+            }
+        }
+    }
 }
 
-bool eink_update(get_rows_cb_t get_rows_cb, void *cb_arg,
-    int x0, int y0, int x1, int y1)
+// copies n pixels from src, starting at its pixel src_x, into dst starting
+// at its pixel dst_x, a byte of dst at a time
+void copy_row_pixels(uint8_t *dst, int dst_x, const uint8_t *src,
+    int src_x, int n)
 {
-    bool stopped = false;
+    int dst_bit = dst_x * PIXEL_BIT_SIZE;
+    int src_bit = src_x * PIXEL_BIT_SIZE;
+    int bits = n * PIXEL_BIT_SIZE;
+
+    while (bits > 0) {
+        // up to the end of the current byte of dst
+        const int dst_ofs = dst_bit & 7;
+        int take = 8 - dst_ofs;
+        if (take > bits) {
+            take = bits;
+        }
 
-    int y;
-    uint8_t old_row[MAX_BITMAP_ROW_SIZE] = {};
-    uint8_t new_row[MAX_BITMAP_ROW_SIZE] = {};
+        const int src_ofs = src_bit & 7;
+        const uint8_t *s = src + (src_bit >> 3);
+        uint16_t window = s[0] << 8;
+        if (src_ofs + take > 8) {
+            window |= s[1];
+        }
+        const uint8_t val = (uint16_t)(window << src_ofs) >> 8;
+        const uint8_t mask = 0xff << (8 - take);
+
+        uint8_t *d = dst + (dst_bit >> 3);
+        *d = (*d & ~(mask >> dst_ofs)) | ((val & mask) >> dst_ofs);
+
+        dst_bit += take;
+        src_bit += take;
+        bits -= take;
+    }
+}
+
+// get the bitmap bits of the 4 pixels starting at pixel x of a row, leftmost
+// pixel in the high bits. all 4 pixels must be inside the row.
+static inline uint16_t get_row_bits(const uint8_t *row, int x)
+{
+    const int bit = x * PIXEL_BIT_SIZE;
+    const uint8_t *p = row + (bit >> 3);
+    const int ofs = bit & 7;
 
-    uint32_t ckv_high_delay_ns;
-    uint32_t ckv_low_delay_ns;
-    // real stop condition is after get_update_waveform_timings
-    for (int wf_stage = 0; !stopped; ++wf_stage) {
-        get_update_waveform_timings(wf_stage,
-            &ckv_high_delay_ns, &ckv_low_delay_ns);
-        if (0 == ckv_high_delay_ns) {
-            break;
+    uint32_t window = (uint32_t)p[0] << 16;
+    if (ofs + DRIVE_BITMAP_BITS > 8) {
+        window |= p[1] << 8;
+    }
+    if (ofs + DRIVE_BITMAP_BITS > 16) {
+        window |= p[2];
+    }
+    return (window >> (24 - ofs - DRIVE_BITMAP_BITS)) & DRIVE_BITMAP_MASK;
+}
+
+// like get_row_bits for the span of w pixels starting at pixel row_x of a
+// row, but pixels outside 0 <= x < w of the span read as 0
+static uint16_t get_row_bits_clipped(const uint8_t *row, int row_x, int x,
+    int w)
+{
+    uint16_t bits = 0;
+    for (int i = 0; i < PVS_PER_IO_BYTE; ++i) {
+        bits <<= PIXEL_BIT_SIZE;
+        if (0 <= x + i && x + i < w) {
+            bits |= get_row_pixel(row, row_x + x + i);
         }
+    }
+    return bits;
+}
 
-        vscan_start();
+// look up the drive byte for the bitmap bits of 4 old and 4 new pixels
+static inline uint8_t lookup_drive_byte(uint16_t old_bits, uint16_t new_bits,
+    const uint8_t *lut)
+{
+#if PIXEL_BIT_SIZE == 1
+    return lut[(old_bits << 4) | new_bits];
+#else
+    uint8_t val = 0;
+    for (int shift = DRIVE_BITMAP_BITS - 4; shift >= 0; shift -= 4) {
+        val <<= LUT_VALUE_BITS;
+        val |= lut[(((old_bits >> shift) & 0xf) << 4)
+            | ((new_bits >> shift) & 0xf)];
+    }
+    return val;
+#endif
+}
 
-        y = 0;
+// encode the drive byte at index i from pixels cut by the span edges, keeping
+// the pixels of drive_row[i] that are outside the span
+static void encode_edge_byte(int i, int x0, int x1,
+    const struct eink_row_span *span, const uint8_t *lut)
+{
+    const int x = i * PVS_PER_IO_BYTE - x0;
+    const int w = x1 - x0;
 
-        if (y < y0) {
-            hscan_solid_row(PV_NEUTRAL);
-            for (; y < y0; ++y) {
-                vscan_write(CLEAR_WRITE_TIME_NS, CLEAR_WRITE_TIME_NS);
-            }
+    uint8_t mask = 0xff;
+    if (i == x0 / PVS_PER_IO_BYTE) {
+        mask &= left_edge_masks[x0 % PVS_PER_IO_BYTE];
+    }
+    if (i == (x1 - 1) / PVS_PER_IO_BYTE) {
+        mask &= right_edge_masks[x1 % PVS_PER_IO_BYTE];
+    }
+
+    const uint8_t val = lookup_drive_byte(
+        get_row_bits_clipped(span->old_row, span->old_x, x, w),
+        get_row_bits_clipped(span->new_row, span->new_x, x, w), lut);
+    drive_row[i] = (drive_row[i] & ~mask) | (val & mask);
+}
+
+// encode pixels x0..x1 of a row into drive_row
+static void encode_row_span(int x0, int x1,
+    const struct eink_row_span *span, const uint8_t *lut)
+{
+    if (x1 <= x0) {
+        return;
+    }
+
+    const int first = x0 / PVS_PER_IO_BYTE;
+    const int last = (x1 - 1) / PVS_PER_IO_BYTE;
+
+    encode_edge_byte(first, x0, x1, span, lut);
+
+    for (int i = first + 1; i < last; ++i) {
+        const int x = i * PVS_PER_IO_BYTE - x0;
+        drive_row[i] = lookup_drive_byte(
+            get_row_bits(span->old_row, span->old_x + x),
+            get_row_bits(span->new_row, span->new_x + x), lut);
+    }
+
+    if (last != first) {
+        encode_edge_byte(last, x0, x1, span, lut);
+    }
+}
+
+// send drive_row to the source drivers. each run of equal bytes is one shift
+// register write and a burst of clocks, and the end of the next run is found
+// while the write is still shifting out.
+static void hscan_drive_row(void)
+{
+    hscan_start();
+
+    int i = 0;
+    while (i < sizeof(drive_row)) {
+        const uint8_t b = drive_row[i];
+        if (b != eink_data_byte) {
+            eink_data_byte = b;
+            eink_hal_sr_start(make_sr_val(eink_ctl, b));
         }
 
+        int run = 1;
+        while (i + run < sizeof(drive_row) && drive_row[i + run] == b) {
+            ++run;
+        }
 
-        for (; y < y1; ++y) {
-            if (!get_rows_cb(cb_arg, y, x0, x1, old_row, new_row)) {
-                stopped = true;
-                break;
-            }
+        eink_hal_sr_wait();
+        hclk(run);
+        i += run;
+    }
 
-            do_row_update_stage(x0, x1, old_row, new_row, wf_stage);
+    hscan_stop();
+}
 
-            vscan_write(ckv_high_delay_ns, ckv_low_delay_ns);
+// sorts region indices by x0, so rows are built left to right
+static void sort_regions_by_x(const struct eink_region *regions,
+    int num_regions, uint8_t *order)
+{
+    for (int i = 0; i < num_regions; ++i) {
+        int j = i;
+        for (; j > 0 && regions[order[j - 1]].x0 > regions[i].x0; --j) {
+            order[j] = order[j - 1];
         }
+        order[j] = i;
+    }
+}
 
-        if (y < SCREEN_HEIGHT) {
-            hscan_solid_row(PV_NEUTRAL);
-            for (; y < SCREEN_HEIGHT; ++y) {
-                vscan_write(CLEAR_WRITE_TIME_NS, CLEAR_WRITE_TIME_NS);
+// whether any of the first w pixels of two rows differ
+static bool bytes_changed(const uint8_t *old_row, const uint8_t *new_row,
+    int w)
+{
+    const int full_bytes = w / PIXELS_PER_BYTE;
+    if (0 != memcmp(old_row, new_row, full_bytes)) {
+        return true;
+    }
+
+    const int rest_bits = (w % PIXELS_PER_BYTE) * PIXEL_BIT_SIZE;
+    const uint8_t mask = 0xff << (8 - rest_bits);
+    return 0 != rest_bits
+        && 0 != ((old_row[full_bytes] ^ new_row[full_bytes]) & mask);
+}
+
+// whether any of the w pixels of a span differ. spans that start part way
+// into a byte are compared a drive byte's pixels at a time.
+static bool span_changed(const struct eink_row_span *span, int w)
+{
+    if (0 == span->old_x % PIXELS_PER_BYTE
+        && 0 == span->new_x % PIXELS_PER_BYTE)
+    {
+        return bytes_changed(span->old_row + span->old_x / PIXELS_PER_BYTE,
+            span->new_row + span->new_x / PIXELS_PER_BYTE, w);
+    }
+
+    int x = 0;
+    for (; x + PVS_PER_IO_BYTE <= w; x += PVS_PER_IO_BYTE) {
+        if (get_row_bits(span->old_row, span->old_x + x)
+            != get_row_bits(span->new_row, span->new_x + x))
+        {
+            return true;
+        }
+    }
+    return x < w
+        && get_row_bits_clipped(span->old_row, span->old_x, x, w)
+            != get_row_bits_clipped(span->new_row, span->new_x, x, w);
+}
+
+// do one stage of updating the old rows -> new rows of every region that
+// includes row y. returns false if there are none, or if the callback said
+// to stop. in a mode that only drives pixels that change, spans that don't
+// change are left neutral without encoding them, and if none of the row's
+// change, it isn't driven and this returns false too.
+static bool do_row_update_stage(struct eink_op *op, int y)
+{
+    const uint32_t start = perf_start();
+    const uint8_t *lut = update_luts[first_update_lut[op->mode] + op->stage];
+    uint8_t old_buf[MAX_BITMAP_ROW_SIZE];
+    uint8_t new_buf[MAX_BITMAP_ROW_SIZE];
+    struct eink_row_span span = {
+        .old_buf = old_buf,
+        .new_buf = new_buf,
+    };
+    bool any = false;
+    bool driven = false;
+
+    for (int i = 0; i < op->num_regions; ++i) {
+        const struct eink_region *r = &op->regions[op->order[i]];
+        if (y < r->y0 || y >= r->y1) {
+            continue;
+        }
+
+        if (!any) {
+            memset(drive_row, QUAD_PIXEL_VALUE(PV_NEUTRAL), sizeof(drive_row));
+            any = true;
+        }
+
+        if (!op->get_span_cb(op->cb_arg, y, r->x0, r->x1, &span)) {
+            op->stopped = true;
+            return false;
+        }
+
+        if (op->only_changed && !span_changed(&span, r->x1 - r->x0)) {
+            continue;
+        }
+
+        encode_row_span(r->x0, r->x1, &span, lut);
+        driven = true;
+    }
+
+    if (driven) {
+        perf_record(PERF_ROW_ENCODE, start);
+        hscan_drive_row();
+    }
+
+    return driven;
+}
+
+static inline bool is_row_unchanged(const struct eink_op *op, int y)
+{
+    return op->unchanged_rows[y / 8] & (1 << (y % 8));
+}
+
+enum EINK_OP_PHASE {
+    OP_STAGE_START = 0,
+    OP_ROWS,
+    OP_STAGE_STOP,
+    OP_DONE,
+};
+
+static eink_temp_cb_t temp_cb;
+static void *temp_cb_arg;
+
+void eink_set_temp_source(eink_temp_cb_t cb, void *arg)
+{
+    temp_cb = cb;
+    temp_cb_arg = arg;
+}
+
+// the temperature band for an op beginning now
+static enum TEMP_BAND read_temp_band(void)
+{
+    int temp_c;
+    if (!temp_cb || !temp_cb(temp_cb_arg, &temp_c)) {
+        return TEMP_BAND_COLD;
+    }
+    return get_temp_band(temp_c);
+}
+
+// get_row_span_cb_t for an op started with a get_rows_cb_t, which copies
+// the rows into the driver's buffers. arg is the op.
+static bool get_span_from_rows(void *arg, int y, int x0, int x1,
+    struct eink_row_span *span)
+{
+    struct eink_op *op = arg;
+    span->old_row = span->old_buf;
+    span->new_row = span->new_buf;
+    span->old_x = 0;
+    span->new_x = 0;
+    return op->get_rows_cb(op->rows_cb_arg, y, x0, x1,
+        span->old_buf, span->new_buf);
+}
+
+void eink_update_spans_begin(struct eink_op *op, enum EINK_MODE mode,
+    get_row_span_cb_t get_span_cb, void *cb_arg,
+    const struct eink_region *regions, int num_regions)
+{
+    *op = (struct eink_op){
+        .mode = mode,
+        .temp_band = read_temp_band(),
+        .only_changed = only_drives_changes[mode],
+        .get_span_cb = get_span_cb,
+        .cb_arg = cb_arg,
+        .regions = regions,
+        .num_regions = num_regions,
+        .rows_y0 = SCREEN_HEIGHT,
+        .rows_y1 = 0,
+    };
+
+    if (num_regions > EINK_MAX_REGIONS) {
+        op->stopped = true;
+        op->phase = OP_DONE;
+        return;
+    }
+
+    sort_regions_by_x(regions, num_regions, op->order);
+
+    for (int i = 0; i < num_regions; ++i) {
+        if (regions[i].y0 < op->rows_y0) op->rows_y0 = regions[i].y0;
+        if (regions[i].y1 > op->rows_y1) op->rows_y1 = regions[i].y1;
+    }
+}
+
+void eink_update_regions_begin(struct eink_op *op, enum EINK_MODE mode,
+    get_rows_cb_t get_rows_cb, void *cb_arg,
+    const struct eink_region *regions, int num_regions)
+{
+    eink_update_spans_begin(op, mode, get_span_from_rows, op,
+        regions, num_regions);
+    op->get_rows_cb = get_rows_cb;
+    op->rows_cb_arg = cb_arg;
+}
+
+void eink_refresh_begin(struct eink_op *op, pixel_t pixel)
+{
+    *op = (struct eink_op){
+        .refresh = true,
+        .pixel = pixel,
+        .temp_band = read_temp_band(),
+    };
+}
+
+// starts the next waveform stage, or finishes the op if there are no more
+static void op_stage_start(struct eink_op *op)
+{
+    // real stop condition is after the waveform timings
+    if (op->refresh) {
+        get_refresh_waveform_timings(op->temp_band, op->stage,
+            &op->ckv_high_delay_ns, &op->ckv_low_delay_ns);
+    } else if (op->stage < num_update_stages[op->mode] && !op->stopped) {
+        get_update_waveform_timings(op->mode, op->temp_band, op->stage,
+            &op->ckv_high_delay_ns, &op->ckv_low_delay_ns);
+    } else {
+        op->ckv_high_delay_ns = 0;
+    }
+
+    if (0 == op->ckv_high_delay_ns) {
+        op->phase = OP_DONE;
+        return;
+    }
+
+    op->stage_start = perf_start();
+    vscan_start();
+
+    if (op->refresh) {
+        hscan_solid_row(get_refresh_waveform_value(op->stage, op->pixel));
+    }
+
+    op->y = 0;
+    op->skip = 0;
+    op->phase = OP_ROWS;
+}
+
+// writes the next row any region covers. rows outside every region are
+// skipped rather than written neutral. that includes the rows after the
+// last region, which still need clocking to move the gate drivers past the
+// bottom.
+static void op_update_rows(struct eink_op *op)
+{
+    for (; op->y < SCREEN_HEIGHT; ++op->y) {
+        if (!op->stopped && op->y >= op->rows_y0 && op->y < op->rows_y1
+            && !is_row_unchanged(op, op->y))
+        {
+            // catch up the gate drivers while OE is still low: sending the
+            // row raises it, and skips after that would drive the row's
+            // data into every row skipped
+            vscan_skip(op->skip);
+            op->skip = 0;
+            if (do_row_update_stage(op, op->y)) {
+                vscan_write(op->ckv_high_delay_ns, op->ckv_low_delay_ns);
+                ++op->y;
+                return;
             }
         }
 
+        // a row found unchanged in the first stage is skipped in the rest
+        // without asking the callback for it again
+        if (op->only_changed) {
+            op->unchanged_rows[op->y / 8] |= 1 << (op->y % 8);
+        }
+        ++op->skip;
+    }
+
+    vscan_skip(op->skip);
+    op->phase = OP_STAGE_STOP;
+}
+
+static void op_refresh_row(struct eink_op *op)
+{
+    vscan_write(op->ckv_high_delay_ns, op->ckv_low_delay_ns);
+
+    // there seem to be extra rows visible, so +10
+    if (++op->y == SCREEN_HEIGHT + 10) {
+        op->phase = OP_STAGE_STOP;
+    }
+}
+
+bool eink_step(struct eink_op *op)
+{
+    switch (op->phase) {
+    case OP_STAGE_START:
+        op_stage_start(op);
+        break;
+
+    case OP_ROWS:
+        if (op->refresh) {
+            op_refresh_row(op);
+        } else {
+            op_update_rows(op);
+        }
+        break;
+
+    case OP_STAGE_STOP:
         vscan_stop();
+        perf_record(op->refresh ? PERF_REFRESH_STAGE : PERF_UPDATE_STAGE,
+            op->stage_start);
+        ++op->stage;
+        op->phase = OP_STAGE_START;
+        break;
     }
 
-    return stopped;
+    return OP_DONE != op->phase;
+}
+
+bool eink_load_waveforms(const void *data, size_t size)
+{
+    const bool ok = !data || waveform_file_check(data, size);
+    waveform_use_file(ok ? data : NULL);
+    build_update_luts();
+    return ok;
+}
+
+bool eink_op_completed(const struct eink_op *op)
+{
+    return !op->stopped;
+}
+
+bool eink_update_regions(enum EINK_MODE mode, get_rows_cb_t get_rows_cb,
+    void *cb_arg, const struct eink_region *regions, int num_regions)
+{
+    struct eink_op op;
+    eink_update_regions_begin(&op, mode, get_rows_cb, cb_arg,
+        regions, num_regions);
+    while (eink_step(&op))
+        ;
+    return eink_op_completed(&op);
+}
+
+bool eink_update_spans(enum EINK_MODE mode, get_row_span_cb_t get_span_cb,
+    void *cb_arg, const struct eink_region *regions, int num_regions)
+{
+    struct eink_op op;
+    eink_update_spans_begin(&op, mode, get_span_cb, cb_arg,
+        regions, num_regions);
+    while (eink_step(&op))
+        ;
+    return eink_op_completed(&op);
+}
+
+bool eink_update(enum EINK_MODE mode, get_rows_cb_t get_rows_cb,
+    void *cb_arg, int x0, int y0, int x1, int y1)
+{
+    const struct eink_region region = { x0, y0, x1, y1 };
+    return eink_update_regions(mode, get_rows_cb, cb_arg, &region, 1);
 }
 
 bool eink_full_update(get_rows_cb_t get_rows_cb, void *cb_arg)
 {
-    return eink_update(get_rows_cb, cb_arg, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    return eink_update(EINK_MODE_FULL, get_rows_cb, cb_arg,
+        0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 }
 
 void eink_refresh(pixel_t pixel)
 {
-    uint32_t ckv_high_delay_ns;
-    uint32_t ckv_low_delay_ns;
-    // stop condition is after get_update_waveform_timings
-    for (int wf_stage = 0; ; ++wf_stage) {
-        get_refresh_waveform_timings(wf_stage,
-            &ckv_high_delay_ns, &ckv_low_delay_ns);
-        if (0 == ckv_high_delay_ns) {
-            break;
-        }
+    struct eink_op op;
+    eink_refresh_begin(&op, pixel);
+    while (eink_step(&op))
+        ;
+}
 
-        vscan_start();
 
-        hscan_solid_row(get_refresh_waveform_value(wf_stage, pixel));
-        // there seem to be extra rows visible, so +10
-        for (int y = 0; y < SCREEN_HEIGHT + 10; ++y) {
-            vscan_write(ckv_high_delay_ns, ckv_low_delay_ns);
-        }
+// how long calibrate_timing runs each measurement for
+#define CALIBRATE_US        1000
+#define CALIBRATE_SR_WRITES 16
 
-        vscan_stop();
+static void calibrate_timing(void)
+{
+    // the cycle counter against the SDK's delay picks up the CPU clock, 80 or
+    // 160MHz
+    uint32_t start = eink_hal_ccount();
+    eink_hal_delay_us(CALIBRATE_US);
+    cycles_per_us = (eink_hal_ccount() - start + CALIBRATE_US / 2)
+        / CALIBRATE_US;
+
+    // eink_ctl doesn't change, so nothing on the board does either
+    start = eink_hal_ccount();
+    for (int i = 0; i < CALIBRATE_SR_WRITES; ++i) {
+        update_sr();
     }
+    sr_write_cycles = (eink_hal_ccount() - start) / CALIBRATE_SR_WRITES;
+
+    timing.cpu_mhz = cycles_per_us;
+    timing.sr_write_ns = cycles_to_ns(sr_write_cycles);
+}
+
+void eink_get_timing(struct eink_timing *t)
+{
+    *t = timing;
+
+    timing.ckv_high_ns = 0;
+    timing.ckv_high_requested_ns = 0;
+    timing.ckv_low_ns = 0;
+    timing.ckv_low_requested_ns = 0;
 }
 
 
 bool eink_setup(void)
 {
-    // hopefully if I understand the datasheet correctly, 10MHz is safe for my
-    // SN74HC595s at 3.3V
-    if (!spi_init(SR_SPI, SPI_MODE0, SPI_FREQ_DIV_10M, true /*msb*/,
-            SPI_BIG_ENDIAN, false /*minimal_pins*/))
-    {
+    if (!eink_hal_sr_setup()) {
         return false;
     }
 
-    gpio_enable(PIN_SR_N_OE, GPIO_OUTPUT);
-    gpio_enable(PIN_CL, GPIO_OUTPUT);
-    gpio_enable(PIN_OE, GPIO_OUTPUT);
+    eink_hal_pin_setup(PIN_SR_N_OE);
+    eink_hal_pin_setup(PIN_CL);
+    eink_hal_pin_setup(PIN_OE);
 
     // initialize SR value to turning screen off, then enable the SR output
     eink_ctl = BIT_SMPS;
     update_ctl();
-    gpio_write(PIN_SR_N_OE, 0);
+    eink_hal_pin_write(PIN_SR_N_OE, 0);
+
+    calibrate_timing();
+    build_update_luts();
 
     return true;
 }
@@ -8,6 +8,7 @@ extern "C" {
 
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -19,15 +20,26 @@ bool eink_setup(void);
 void eink_power_on(void);
 void eink_power_off(void);
 
+// pixels are grey levels from WHITE to BLACK, PIXEL_BIT_SIZE bits each.
+// build with -DPIXEL_BIT_SIZE=2 or 4 for greyscale.
 typedef int pixel_t;
+#ifndef PIXEL_BIT_SIZE
 #define PIXEL_BIT_SIZE 1
+#endif
 #define WHITE 0
-#define BLACK 1
+#define BLACK PIXEL_BITMASK
+#define NUM_GREY_LEVELS (1 << PIXEL_BIT_SIZE)
+
+#if PIXEL_BIT_SIZE != 1 && PIXEL_BIT_SIZE != 2 && PIXEL_BIT_SIZE != 4
+#error PIXEL_BIT_SIZE must be 1, 2 or 4
+#endif
 
 
 #define PIXEL_BITMASK ((1<<PIXEL_BIT_SIZE) - 1)
 #define PIXELS_PER_BYTE (8 / PIXEL_BIT_SIZE)
 #define MAX_BITMAP_ROW_SIZE (SCREEN_WIDTH / PIXELS_PER_BYTE)
+// bytes in a bitmap row w pixels wide
+#define BITMAP_ROW_SIZE(w) (((w) + PIXELS_PER_BYTE - 1) / PIXELS_PER_BYTE)
 
 static inline pixel_t get_row_pixel(const uint8_t *row, int x) {
     const int byte_index = x / PIXELS_PER_BYTE;
@@ -43,26 +55,182 @@ static inline void set_row_pixel(uint8_t *row, int x, pixel_t p) {
     row[byte_index] = (row[byte_index] & ~shifted_bitmask) | shifted_pixel;
 }
 
+// copies n pixels from src, starting at its pixel src_x, into dst starting
+// at its pixel dst_x. the rest of dst is left as it is.
+void copy_row_pixels(uint8_t *dst, int dst_x, const uint8_t *src,
+    int src_x, int n);
+
+
+// how an update drives the panel
+enum EINK_MODE {
+    // every pixel of the regions goes through the whole update waveform,
+    // unchanged ones included, which flashes but leaves no ghosting
+    EINK_MODE_FULL = 0,
+    // only pixels that change are driven, straight to the nearer of black
+    // and white, in a fraction of the time. each one leaves a little ghosting
+    // behind, until a full update goes over it.
+    EINK_MODE_FAST,
+    // the full waveform for pixels that change, and nothing for the rest, so
+    // there's no flash outside them. rows where nothing changes are skipped.
+    // unchanged pixels aren't cleaned, so ghosting builds up as with
+    // EINK_MODE_FAST, only more slowly.
+    EINK_MODE_PARTIAL,
+    NUM_EINK_MODES,
+};
+
 
 // callback that generates both the row to be replaced and the new row to be
 // drawn.
-// output is in bitmap format, 1 bit per pixel, leftmost pixel in MSB.
+// output is in bitmap format, PIXEL_BIT_SIZE bits per pixel, leftmost pixel
+// in MSB.
 // callback can return false to say drawing should stop.
 // callback is guaranteed to be called in increasing y order.
+// x0 and x1 are the region being drawn, and the bitmaps start at x0.
 typedef bool (*get_rows_cb_t)(void *arg, int y,
     int x0, int x1, uint8_t *old_row_bitmap, uint8_t *new_row_bitmap);
 
-// draw from (x0, y0)-(x1, y1)
-// returns true if drawing was completed
-bool eink_update(get_rows_cb_t get_rows_cb, void *cb_arg,
-    int x0, int y0, int x1, int y1);
+// where the old and new rows of a span are, for a get_row_span_cb_t.
+// pixel x0 of the span is pixel old_x of old_row, and pixel new_x of
+// new_row. the rows only have to stay put until the callback is called
+// again.
+struct eink_row_span {
+    const uint8_t *old_row;
+    const uint8_t *new_row;
+    int old_x;
+    int new_x;
+    // MAX_BITMAP_ROW_SIZE bytes each, set by the driver, for the callback to
+    // build rows in when it has nothing to point at
+    uint8_t *old_buf;
+    uint8_t *new_buf;
+};
+
+// like get_rows_cb_t, but points span at the rows wherever they already
+// are, rather than copying them into the driver's buffers
+typedef bool (*get_row_span_cb_t)(void *arg, int y, int x0, int x1,
+    struct eink_row_span *span);
 
+// draw from (x0, y0)-(x1, y1)
 // returns true if drawing was completed
+bool eink_update(enum EINK_MODE mode, get_rows_cb_t get_rows_cb,
+    void *cb_arg, int x0, int y0, int x1, int y1);
+
+
+#define EINK_MAX_REGIONS 32
+
+// a rectangle from (x0, y0) to (x1, y1), like the arguments of eink_update
+struct eink_region {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// draw several non-overlapping regions in a single set of scans.
+// the callback is called with each region's x0 and x1 for every row in it;
+// regions that share a row are called in increasing x0 order.
+// returns true if drawing was completed, false if the callback stopped it or
+// there are more than EINK_MAX_REGIONS regions.
+bool eink_update_regions(enum EINK_MODE mode, get_rows_cb_t get_rows_cb,
+    void *cb_arg, const struct eink_region *regions, int num_regions);
+
+// eink_update_regions with a get_row_span_cb_t
+bool eink_update_spans(enum EINK_MODE mode, get_row_span_cb_t get_span_cb,
+    void *cb_arg, const struct eink_region *regions, int num_regions);
+
+// a full mode update of the whole screen. returns true if drawing was
+// completed.
 bool eink_full_update(get_rows_cb_t get_rows_cb, void *cb_arg);
 
 void eink_refresh(pixel_t pixel);
 
 
+// reads the panel's temperature in degrees C into temp_c. returns false if
+// it can't.
+typedef bool (*eink_temp_cb_t)(void *arg, int *temp_c);
+
+// where updates and refreshes read the temperature that picks their waveform
+// timings, once as each begins. without one, or if it fails, they take the
+// coldest timings, which are the slowest but work at any temperature.
+void eink_set_temp_source(eink_temp_cb_t temp_cb, void *arg);
+
+// switches to the waveforms of a waveform file (see waveform.h), or back to
+// the built in ones if data is NULL. a file that fails its checks switches
+// back to the built in ones too, and returns false. only between ops: one in
+// progress would go on with the new waveforms part way through.
+bool eink_load_waveforms(const void *data, size_t size);
+
+
+// an update or refresh in progress, run a piece at a time so the caller can
+// do other things in between, like letting other tasks run.
+// eink_update_regions and eink_refresh run one to the end.
+// the fields are the driver's. only one op can be in progress at a time.
+struct eink_op {
+    get_row_span_cb_t get_span_cb;
+    void *cb_arg;
+    // for an op started with a get_rows_cb_t, which get_span_cb wraps
+    get_rows_cb_t get_rows_cb;
+    void *rows_cb_arg;
+    const struct eink_region *regions;
+    int num_regions;
+    uint8_t order[EINK_MAX_REGIONS];
+    // rows any region covers
+    int rows_y0;
+    int rows_y1;
+    enum EINK_MODE mode;
+    // a TEMP_BAND, picked as the op began
+    int temp_band;
+    // the mode only drives pixels that change, and these rows have none
+    bool only_changed;
+    uint8_t unchanged_rows[(SCREEN_HEIGHT + 7) / 8];
+
+    bool refresh;
+    pixel_t pixel;
+
+    int stage;
+    int phase;
+    int y;
+    // rows passed over since the last one written
+    int skip;
+    uint32_t ckv_high_delay_ns;
+    uint32_t ckv_low_delay_ns;
+    uint32_t stage_start;
+    bool stopped;
+};
+
+// starts an op that does what eink_update_regions or eink_refresh would.
+// regions must stay put until the op is done.
+void eink_update_regions_begin(struct eink_op *op, enum EINK_MODE mode,
+    get_rows_cb_t get_rows_cb, void *cb_arg,
+    const struct eink_region *regions, int num_regions);
+void eink_update_spans_begin(struct eink_op *op, enum EINK_MODE mode,
+    get_row_span_cb_t get_span_cb, void *cb_arg,
+    const struct eink_region *regions, int num_regions);
+void eink_refresh_begin(struct eink_op *op, pixel_t pixel);
+
+// does the next piece of an op: starting or ending a waveform stage, which
+// waits a few ms, or writing one row. returns false once the op is done.
+// interrupts are only masked during CKV pulses.
+bool eink_step(struct eink_op *op);
+
+// for a done update, what eink_update_regions would have returned
+bool eink_op_completed(const struct eink_op *op);
+
+
+// what eink_setup measured, and of the rows written since the last call,
+// the CKV high and low times that came out furthest over what was asked for.
+// pulses can't be shorter than an SR write.
+struct eink_timing {
+    uint32_t cpu_mhz;
+    uint32_t sr_write_ns;
+    uint32_t ckv_high_ns;
+    uint32_t ckv_high_requested_ns;
+    uint32_t ckv_low_ns;
+    uint32_t ckv_low_requested_ns;
+};
+
+void eink_get_timing(struct eink_timing *timing);
+
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
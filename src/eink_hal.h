@@ -0,0 +1,153 @@
+#ifndef __EINK_HAL_H__
+#define __EINK_HAL_H__
+
+
+// thin hardware layer under the eink driver: the shift register on SPI, the
+// control pins outside it, delays and interrupt masking.
+// the ESP8266 backend is inline below. building with EINK_HOST declares the
+// same functions and leaves them to a host backend (see host/hal_mock.c), so
+// the driver can be built and measured off the board.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#ifdef EINK_HOST
+
+
+bool eink_hal_sr_setup(void);
+void eink_hal_sr_write(uint16_t val);
+
+// start shifting a word out and return while it's still going. the outputs
+// only latch once eink_hal_sr_wait returns.
+void eink_hal_sr_start(uint16_t val);
+void eink_hal_sr_wait(void);
+
+void eink_hal_pin_setup(uint8_t pin);
+void eink_hal_pin_write(uint8_t pin, bool val);
+
+// set or clear every pin in a mask of GPIO bits (1 << pin) at once
+void eink_hal_pins_set(uint32_t gpio_mask);
+void eink_hal_pins_clear(uint32_t gpio_mask);
+
+void eink_hal_delay_us(uint32_t us);
+
+// waits at least ms, letting other tasks run meanwhile. only from a task.
+void eink_hal_sleep_ms(uint32_t ms);
+
+// the CPU cycle counter, and waiting until it's cycles past start
+uint32_t eink_hal_ccount(void);
+void eink_hal_delay_until(uint32_t start, uint32_t cycles);
+
+uint32_t eink_hal_disable_interrupts(void);
+void eink_hal_restore_interrupts(uint32_t old_interrupts);
+
+
+#else
+
+
+#include "espressif/esp_common.h"
+#include "espressif/esp_misc.h"
+#include "esp/gpio.h"
+#include "esp/spi.h"
+#include "esp/interrupts.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+// SPI used for shift register
+#define SR_SPI 1
+
+
+static inline bool eink_hal_sr_setup(void)
+{
+    // hopefully if I understand the datasheet correctly, 10MHz is safe for my
+    // SN74HC595s at 3.3V
+    return spi_init(SR_SPI, SPI_MODE0, SPI_FREQ_DIV_10M, true /*msb*/,
+        SPI_BIG_ENDIAN, false /*minimal_pins*/);
+}
+
+static inline void eink_hal_sr_write(uint16_t val)
+{
+    spi_transfer_16(SR_SPI, val);
+}
+
+static inline void eink_hal_sr_wait(void)
+{
+    while (SPI(SR_SPI).CMD & SPI_CMD_USR)
+        ;
+}
+
+// the same register writes as spi_transfer_16, minus waiting for the end.
+// the transfer size is left at 16 bits by the spi_transfer_16 calls made
+// before any row is sent, and a big endian bus wants the halfword on top.
+static inline void eink_hal_sr_start(uint16_t val)
+{
+    eink_hal_sr_wait();
+    SPI(SR_SPI).W[0] = (uint32_t)val << 16;
+    SPI(SR_SPI).CMD |= SPI_CMD_USR;
+}
+
+static inline void eink_hal_pin_setup(uint8_t pin)
+{
+    gpio_enable(pin, GPIO_OUTPUT);
+}
+
+static inline void eink_hal_pin_write(uint8_t pin, bool val)
+{
+    gpio_write(pin, val);
+}
+
+// single writes to the GPIO set/clear registers. only for GPIO0-15.
+static inline void eink_hal_pins_set(uint32_t gpio_mask)
+{
+    GPIO.OUT_SET = gpio_mask;
+}
+
+static inline void eink_hal_pins_clear(uint32_t gpio_mask)
+{
+    GPIO.OUT_CLEAR = gpio_mask;
+}
+
+static inline void eink_hal_delay_us(uint32_t us)
+{
+    sdk_os_delay_us(us);
+}
+
+static inline void eink_hal_sleep_ms(uint32_t ms)
+{
+    // vTaskDelay(n) ends at the n-th tick from now, and the first of those
+    // can come right away, so one more makes it at least ms
+    vTaskDelay((ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS + 1);
+}
+
+static inline uint32_t eink_hal_ccount(void)
+{
+    uint32_t ccount;
+    __asm__ __volatile__ ("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+}
+
+// wraps fine, as long as cycles is under 2^32 (53s at 80MHz)
+static inline void eink_hal_delay_until(uint32_t start, uint32_t cycles)
+{
+    while ((uint32_t)(eink_hal_ccount() - start) < cycles)
+        ;
+}
+
+static inline uint32_t eink_hal_disable_interrupts(void)
+{
+    return _xt_disable_interrupts();
+}
+
+static inline void eink_hal_restore_interrupts(uint32_t old_interrupts)
+{
+    _xt_restore_interrupts(old_interrupts);
+}
+
+
+#endif
+
+
+#endif
@@ -0,0 +1,112 @@
+#include "ghost.h"
+#include "shadow.h"
+
+
+#if GHOST_ROWS * ((GHOST_COLS + 1) / 2) > EINK_MAX_REGIONS
+#error ghost_clean_regions could need more than EINK_MAX_REGIONS regions
+#endif
+
+static uint16_t counts[GHOST_ROWS][GHOST_COLS];
+
+
+static struct eink_region cell_region(int row, int col)
+{
+    struct eink_region r = {
+        .x0 = col * GHOST_CELL_SIZE,
+        .y0 = row * GHOST_CELL_SIZE,
+        .x1 = (col + 1) * GHOST_CELL_SIZE,
+        .y1 = (row + 1) * GHOST_CELL_SIZE,
+    };
+    if (r.x1 > SCREEN_WIDTH) r.x1 = SCREEN_WIDTH;
+    if (r.y1 > SCREEN_HEIGHT) r.y1 = SCREEN_HEIGHT;
+    return r;
+}
+
+static bool overlaps(const struct eink_region *a, const struct eink_region *b)
+{
+    return a->x0 < b->x1 && b->x0 < a->x1 && a->y0 < b->y1 && b->y0 < a->y1;
+}
+
+static bool covers(const struct eink_region *a, const struct eink_region *b)
+{
+    return a->x0 <= b->x0 && b->x1 <= a->x1
+        && a->y0 <= b->y0 && b->y1 <= a->y1;
+}
+
+void ghost_drawn(enum EINK_MODE mode, const struct eink_region *regions,
+    int num_regions)
+{
+    for (int row = 0; row < GHOST_ROWS; ++row) {
+        for (int col = 0; col < GHOST_COLS; ++col) {
+            const struct eink_region cell = cell_region(row, col);
+
+            // one update counts once, however many of its regions touch
+            // the cell
+            bool touched = false;
+            bool cleaned = false;
+            for (int i = 0; i < num_regions; ++i) {
+                touched = touched || overlaps(&regions[i], &cell);
+                cleaned = cleaned || covers(&regions[i], &cell);
+            }
+
+            if (EINK_MODE_FULL != mode) {
+                if (touched && counts[row][col] < 0xffff) {
+                    ++counts[row][col];
+                }
+            } else if (cleaned) {
+                counts[row][col] = 0;
+            }
+        }
+    }
+}
+
+bool ghost_over(int budget)
+{
+    for (int row = 0; row < GHOST_ROWS; ++row) {
+        for (int col = 0; col < GHOST_COLS; ++col) {
+            if (counts[row][col] > budget) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool shadow_knows_rows(int row)
+{
+    const struct eink_region cell = cell_region(row, 0);
+    for (int y = cell.y0; y < cell.y1; ++y) {
+        if (!shadow_row_known(y)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int ghost_clean_regions(int budget, struct eink_region *regions)
+{
+    int n = 0;
+    for (int row = 0; row < GHOST_ROWS; ++row) {
+        const bool known = shadow_knows_rows(row);
+
+        for (int col = 0; col < GHOST_COLS; ++col) {
+            if (counts[row][col] <= budget) {
+                continue;
+            }
+            if (!known) {
+                counts[row][col] = 0;
+                continue;
+            }
+
+            const struct eink_region cell = cell_region(row, col);
+            if (n > 0 && regions[n - 1].y0 == cell.y0
+                && regions[n - 1].x1 == cell.x0)
+            {
+                regions[n - 1].x1 = cell.x1;
+            } else {
+                regions[n++] = cell;
+            }
+        }
+    }
+    return n;
+}
@@ -0,0 +1,44 @@
+#ifndef __GHOST_H__
+#define __GHOST_H__
+
+
+// fast and partial updates leave a little of what was there before. the
+// screen is split into GHOST_CELL_SIZE square cells, each counting the fast
+// and partial updates that have touched it since a full update last covered
+// all of it. once a cell has had more than its budget, it's due a clean: a
+// full update of what's already there, from the shadow.
+
+
+#include <stdbool.h>
+#include "eink.h"
+
+
+// fast or partial updates a cell takes before it's cleaned when the device
+// is idle
+#ifndef GHOST_BUDGET
+#define GHOST_BUDGET 20
+#endif
+
+// updates a cell takes before it's cleaned even if more are waiting
+#define GHOST_HARD_BUDGET (2 * GHOST_BUDGET)
+
+#define GHOST_CELL_SIZE 100
+#define GHOST_COLS ((SCREEN_WIDTH + GHOST_CELL_SIZE - 1) / GHOST_CELL_SIZE)
+#define GHOST_ROWS ((SCREEN_HEIGHT + GHOST_CELL_SIZE - 1) / GHOST_CELL_SIZE)
+
+
+// an update in mode has drawn regions
+void ghost_drawn(enum EINK_MODE mode, const struct eink_region *regions,
+    int num_regions);
+
+// whether any cell has had more than budget fast or partial updates
+bool ghost_over(int budget);
+
+// fills regions with the cells over budget, a run of them along a row of
+// cells at a time, for a full update that cleans them. returns how many.
+// cells with rows the shadow doesn't know can't be redrawn as they are, so
+// they're left out, and start counting again.
+int ghost_clean_regions(int budget, struct eink_region *regions);
+
+
+#endif
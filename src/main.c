@@ -3,113 +3,784 @@
 #include "espressif/esp_sta.h"
 #include "espressif/user_interface.h"
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <lwip/sockets.h>
 #include "esp/uart.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "eink.h"
+#include "chunk.h"
+#include "crc32.h"
+#include "display.h"
+#include "ghost.h"
 #include "missing_api.h"
+#include "perf.h"
+#include "protocol.h"
+#include "rle.h"
+#include "shadow.h"
 #include "skall.h"
+#include "thermistor.h"
+#include "waveform.h"
+#include "waveform_store.h"
 #include "private_ssid_config.h"
 
 
-#define LISTEN_PORT 3124
+#define MY_UART 0
 
 
-#define MY_UART 0
+// returns true if the socket has data to read within timeout_ms
+static bool wait_readable(int sock, int timeout_ms)
+{
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(sock, &read_fds);
+
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+
+    return lwip_select(sock + 1, &read_fds, NULL, NULL, &timeout) > 0;
+}
+
+// returns the command byte the client started with, CMD_NONE if it didn't
+// send anything within CMD_WAIT_MS, or CMD_CLOSED if it's gone.
+#define CMD_NONE    (-1)
+#define CMD_CLOSED  (-2)
 
+static int read_command(int client_sock)
+{
+    if (!wait_readable(client_sock, CMD_WAIT_MS)) {
+        return CMD_NONE;
+    }
+
+    uint8_t cmd;
+    if (!recvall(client_sock, &cmd, sizeof(cmd))) {
+        return CMD_CLOSED;
+    }
 
-// a full frame buffer is 60KB, but we don't have that much available RAM on
-// the ESP8266, so we get it in chunks
-#define SCREEN_BITMAP_WIDTH 800
-#define SCREEN_BITMAP_HEIGHT 600
-#define SCREEN_BITMAP_X_OFS 0
-#define SCREEN_BITMAP_Y_OFS 0
-#define CHUNK_WIDTH 205
-#define CHUNK_HEIGHT 205
-#define CHUNK_OVERLAP 5
+    return cmd;
+}
 
-static uint8_t old_chunk[CHUNK_HEIGHT][CHUNK_WIDTH / PIXELS_PER_BYTE];
-static uint8_t new_chunk[CHUNK_HEIGHT][CHUNK_WIDTH / PIXELS_PER_BYTE];
 
+// what recv_data has received since recv_check_start, for framed chunks:
+// the CRC, and how many bytes, which mustn't go past the frame's length
+static bool recv_checking;
+static uint32_t recv_crc;
+static uint32_t recv_count;
+static uint32_t recv_limit;
 
-struct chunk_params {
-    int x;
-    int y;
-    int byte_w;
-};
+static void recv_check_start(bool check, uint32_t crc, uint32_t limit)
+{
+    recv_checking = check;
+    recv_crc = crc;
+    recv_count = 0;
+    recv_limit = limit;
+}
 
-bool get_rows_from_chunks(void *arg, int y, int x0, int x1, uint8_t *old_row,
-    uint8_t *new_row)
+// recvall for a chunk's data. a damaged chunk header could ask for far more
+// than the frame holds, and reading on into the next frames could then wait
+// for data the client is never going to send.
+static bool recv_data(int client_sock, uint8_t *buf, int size)
 {
-    struct chunk_params *cp = arg;
-    memcpy(old_row, old_chunk[y - cp->y], cp->byte_w);
-    memcpy(new_row, new_chunk[y - cp->y], cp->byte_w);
+    if (recv_checking && size > recv_limit - recv_count)
+        return false;
+
+    if (!recvall(client_sock, buf, size))
+        return false;
+
+    if (recv_checking) {
+        recv_crc = crc32_update(recv_crc, buf, size);
+        recv_count += size;
+    }
     return true;
 }
 
+// receives enc_size bytes of rle_encode()d data that must decode to exactly
+// size bytes at dst
+#define RECV_RLE_BUF_SIZE 128
 
-void handle_conn(int client_sock)
+static bool recv_rle(int client_sock, int enc_size, uint8_t *dst, int size)
+{
+    struct rle_decoder dec;
+    rle_decoder_init(&dec);
+
+    uint8_t *dst_end = dst + size;
+    uint8_t buf[RECV_RLE_BUF_SIZE];
+
+    while (enc_size > 0) {
+        const int n = (enc_size < sizeof(buf)) ? enc_size : sizeof(buf);
+        if (!recv_data(client_sock, buf, n))
+            return false;
+        enc_size -= n;
+
+        const uint8_t *p = buf;
+        rle_decode(&dec, &p, n, &dst, dst_end - dst);
+        if (p != buf + n) {
+            // decodes to more than size bytes
+            return false;
+        }
+    }
+
+    return dst == dst_end && rle_decoder_done(&dec);
+}
+
+// receives a chunk's old and new bitmaps, size bytes each, into buf at ofs.
+// without has_old, only the new bitmap is sent.
+static bool recv_chunk(int client_sock, bool encoded, bool has_old,
+    struct chunk_buf *buf, int ofs, int size)
+{
+    uint8_t *old_bits = buf->old_bits + ofs;
+    uint8_t *new_bits = buf->new_bits + ofs;
+
+    struct chunk_header ch = {
+        .encoding = CHUNK_RAW,
+    };
+    if (encoded && !recv_data(client_sock, (void*)&ch, sizeof(ch)))
+        return false;
+
+    switch (ch.encoding) {
+    case CHUNK_RAW:
+        return (!has_old || recv_data(client_sock, old_bits, size))
+            && recv_data(client_sock, new_bits, size);
+
+    case CHUNK_RLE_XOR:
+        if (!has_old) {
+            // the delta is against all 0s, so it's just the new bitmap
+            return 0 == ch.old_size
+                && recv_rle(client_sock, ch.delta_size, new_bits, size);
+        }
+
+        if (!(recv_rle(client_sock, ch.old_size, old_bits, size)
+            && recv_rle(client_sock, ch.delta_size, new_bits, size)))
+            return false;
+
+        for (int i = 0; i < size; ++i) {
+            new_bits[i] ^= old_bits[i];
+        }
+        return true;
+
+    default:
+        printf("bad chunk encoding %d\n", ch.encoding);
+        return false;
+    }
+}
+
+
+// display jobs the network side can fill, and how many it has queued. chunks
+// are received into one job while the display task draws the other.
+static struct display_job *free_jobs[NUM_DISPLAY_JOBS];
+static int num_free_jobs;
+static int num_drawing_jobs;
+
+// the last PROTO_CMD_FRAMED transfer, and the seq after its last drawn
+// rectangle. a client that reconnects with the same id resumes from there,
+// unless something else has been drawn since: the id only says what the
+// transfer draws, so sending it again has to draw it again.
+static bool have_transfer;
+static uint32_t transfer_id;
+static uint32_t transfer_drawn_seq;
+
+static void put_job(struct display_job *job)
+{
+    free_jobs[num_free_jobs++] = job;
+}
+
+// takes an empty job. there must be a free one; see reclaim_job.
+static struct display_job *take_job(void)
+{
+    struct display_job *job = free_jobs[--num_free_jobs];
+    job->list.num_chunks = 0;
+    job->num_rects = 0;
+    job->framed = false;
+    job->mode = EINK_MODE_FULL;
+    job->clean = false;
+    job->waveform = false;
+    job->size = 0;
+    return job;
+}
+
+static void draw_job(struct display_job *job)
+{
+    display_draw_job(job);
+    ++num_drawing_jobs;
+}
+
+// waits up to wait ticks for the oldest queued job to be drawn and frees it.
+// returns it, or NULL if nothing was drawn in time. a framed job moves the
+// resume point on even if the client never hears about it.
+static struct display_job *reclaim_job(TickType_t wait)
+{
+    if (0 == num_drawing_jobs) {
+        return NULL;
+    }
+
+    struct display_job *job = display_wait_drawn(wait);
+    if (job) {
+        --num_drawing_jobs;
+        put_job(job);
+        if (job->framed) {
+            transfer_drawn_seq = job->first_seq + job->num_rects;
+        }
+    }
+    return job;
+}
+
+
+// how long the panel's rails stay up after the last connection that drew,
+// so a burst of updates pays for sequencing them (well over 100ms) once. 0
+// powers off after every connection.
+#ifndef POWER_IDLE_MS
+#define POWER_IDLE_MS 2000
+#endif
+
+static bool powered;
+// when the last connection that drew finished
+static TickType_t power_idle_start;
+
+static void power_up(void)
 {
+    if (powered) {
+        return;
+    }
     printf("powering on...\n");
     eink_power_on();
-    printf("here we go!\n");
+    powered = true;
+    perf_count(PERF_POWER_UPS, 1);
+}
+
+static void power_down(void)
+{
+    if (!powered) {
+        return;
+    }
+    printf("powering off\n");
+    eink_power_off();
+    powered = false;
+    perf_count(PERF_POWER_DOWNS, 1);
+}
+
+// starts the idle timeout, or powers off straight away without one
+static void power_idle(void)
+{
+    power_idle_start = xTaskGetTickCount();
+    if (0 == POWER_IDLE_MS) {
+        power_down();
+    }
+}
+
+// how long until the idle timeout runs out, or -1 if the rails are down
+static int power_idle_left_ms(void)
+{
+    if (!powered) {
+        return -1;
+    }
+    const int idle_ms = (xTaskGetTickCount() - power_idle_start)
+        * portTICK_PERIOD_MS;
+    return (idle_ms < POWER_IDLE_MS) ? POWER_IDLE_MS - idle_ms : 0;
+}
+
+
+// how long the client has to be quiet before the device cleans up after
+// fast and partial updates
+#define GHOST_IDLE_MS 300
+
+// queues a clean of the cells taken over budget, if there are any and a job
+// is free. returns true if it did.
+static bool clean_ghosts(void)
+{
+    if (0 == num_free_jobs || !ghost_over(GHOST_BUDGET)) {
+        return false;
+    }
+
+    struct display_job *job = take_job();
+    job->clean = true;
+    draw_job(job);
+    return true;
+}
+
+
+static void handle_tiles(int client_sock, bool encoded, enum EINK_MODE mode)
+{
+    // a failed send or receive leaves the stream at an unknown place, so
+    // there's no going on to the next tile
+    bool ok = true;
 
-    for (int y = 0; y < SCREEN_BITMAP_HEIGHT; y += CHUNK_HEIGHT - CHUNK_OVERLAP) {
-        for (int x = 0; x < SCREEN_BITMAP_WIDTH; x += CHUNK_WIDTH - CHUNK_OVERLAP) {
+    for (int y = 0; ok && y < SCREEN_BITMAP_HEIGHT; y += CHUNK_HEIGHT - CHUNK_OVERLAP) {
+        for (int x = 0; ok && x < SCREEN_BITMAP_WIDTH; x += CHUNK_WIDTH - CHUNK_OVERLAP) {
             int w = SCREEN_BITMAP_WIDTH - x;
             if (w > CHUNK_WIDTH) w = CHUNK_WIDTH;
 
             int h = SCREEN_BITMAP_HEIGHT - y;
             if (h > CHUNK_HEIGHT) h = CHUNK_HEIGHT;
 
-            int byte_w = (w+7)/8;
+            int byte_w = BITMAP_ROW_SIZE(w);
+
+            if (0 == num_free_jobs) {
+                reclaim_job(portMAX_DELAY);
+            }
+            struct display_job *job = take_job();
 
             if (!(sendall(client_sock, (void*)&x, sizeof(x))
                 && sendall(client_sock, (void*)&y, sizeof(y))
                 && sendall(client_sock, (void*)&w, sizeof(w))
-                && sendall(client_sock, (void*)&h, sizeof(h))))
-                continue;
-
-            bool err = false;
-
-            for (int row_y = 0; row_y < h; ++row_y) {
-                if (!recvall(client_sock, old_chunk[row_y], byte_w)) {
-                    err = true;
-                    break;
-                }
-            }
-            if (err)
-                continue;
-
-            for (int row_y = 0; row_y < h; ++row_y) {
-                if (!recvall(client_sock, new_chunk[row_y], byte_w)) {
-                    err = true;
-                    break;
-                }
+                && sendall(client_sock, (void*)&h, sizeof(h))
+                && recv_chunk(client_sock, encoded, true, job->buf, 0,
+                    h * byte_w)))
+            {
+                put_job(job);
+                ok = false;
+                break;
             }
-            if (err)
-                continue;
 
-            struct chunk_params cp = {
+            job->mode = mode;
+            job->list.num_chunks = 1;
+            job->list.regions[0] = (struct eink_region){
+                .x0 = SCREEN_BITMAP_X_OFS + x,
+                .y0 = SCREEN_BITMAP_Y_OFS + y,
+                .x1 = SCREEN_BITMAP_X_OFS + x + w,
+                .y1 = SCREEN_BITMAP_Y_OFS + y + h,
+            };
+            job->list.chunks[0] = (struct chunk_params){
+                .buf = job->buf,
+                .has_old = true,
                 .x = SCREEN_BITMAP_X_OFS + x,
                 .y = SCREEN_BITMAP_Y_OFS + y,
                 .byte_w = byte_w,
             };
 
-            eink_update(get_rows_from_chunks, &cp,
-                SCREEN_BITMAP_X_OFS + x,
-                SCREEN_BITMAP_Y_OFS + y,
-                SCREEN_BITMAP_X_OFS + x + w,
-                SCREEN_BITMAP_Y_OFS + y + h);
+            // the next tile is received while this one is drawn
+            draw_job(job);
         }
     }
 
-    printf("powering off\n");
-    eink_power_off();
+    while (reclaim_job(portMAX_DELAY))
+        ;
+
+    if (ok && clean_ghosts()) {
+        reclaim_job(portMAX_DELAY);
+    }
+}
+
+// rectangles one job answers for. replaced ones don't take up chunks, so
+// there can be more of them than EINK_MAX_REGIONS.
+#define MAX_JOB_RECTS 64
+
+// sends the statuses of a drawn job's rectangles, including ones that later
+// rectangles replaced
+static bool ack_rects(int client_sock, const struct display_job *job)
+{
+    const int n = job ? job->num_rects : 0;
+    if (0 == n) {
+        return true;
+    }
+
+    if (job->framed) {
+        for (int i = 0; i < n; ++i) {
+            const struct frame_ack ack = { job->first_seq + i, RECT_OK };
+            if (!sendall(client_sock, (void*)&ack, sizeof(ack)))
+                return false;
+        }
+        return true;
+    }
+
+    uint8_t statuses[MAX_JOB_RECTS];
+    memset(statuses, RECT_OK, n);
+    return sendall(client_sock, statuses, n);
+}
+
+// how long to wait for a job to be drawn before checking the socket again,
+// when the client has nothing more to send
+#define ACK_POLL_MS 10
+
+// receives the next rectangle's header. framed ones are checked against
+// the magic number and the seq expected next; *error_status is RECT_NAK if
+// that fails.
+static bool recv_rect_header(int client_sock, bool framed, uint32_t seq,
+    struct rect_header *rh, struct frame_header *fh, uint8_t *error_status)
+{
+    if (!framed) {
+        return recvall(client_sock, (void*)rh, sizeof(*rh));
+    }
+
+    if (!recvall(client_sock, (void*)fh, sizeof(*fh)))
+        return false;
+
+    *rh = (struct rect_header){ fh->x, fh->y, fh->w, fh->h };
+    if (FRAME_MAGIC != fh->magic
+        || (seq != fh->seq && 0 != fh->w && 0 != fh->h))
+    {
+        printf("bad frame %u, expected %u\n", fh->seq, seq);
+        *error_status = RECT_NAK;
+    }
+    return true;
+}
+
+// after a NAK, how long to wait for more from the client before giving up on
+// it hanging up. closing with its data unread resets the connection, which
+// can lose the acks and the NAK on their way to it.
+#define NAK_DRAIN_MS 1000
+
+static void drain(int client_sock)
+{
+    uint8_t buf[RECV_RLE_BUF_SIZE];
+    while (wait_readable(client_sock, NAK_DRAIN_MS)
+        && lwip_recv(client_sock, buf, sizeof(buf), 0) > 0)
+        ;
+}
+
+// with framed, rectangles come as in PROTO_CMD_FRAMED; encoded is true and
+// has_old is false
+static void handle_rects(int client_sock, bool encoded, bool has_old,
+    bool framed, enum EINK_MODE mode)
+{
+    uint32_t seq = 0;
+    if (framed) {
+        uint32_t id;
+        if (!recvall(client_sock, (void*)&id, sizeof(id)))
+            return;
+
+        if (!have_transfer || id != transfer_id) {
+            have_transfer = true;
+            transfer_id = id;
+            transfer_drawn_seq = 0;
+        }
+        seq = transfer_drawn_seq;
+    }
+
+    struct framed_hello hello = {
+        .rects = {
+            .max_bitmap_size = CHUNK_BUF_SIZE,
+            .pixel_bits = PIXEL_BIT_SIZE,
+        },
+        .resume_seq = seq,
+    };
+    if (!sendall(client_sock, (void*)&hello,
+        framed ? sizeof(hello) : sizeof(hello.rects)))
+        return;
+
+    // the job rectangles are received into. it's drawn once the client
+    // stops sending, or when the next rectangle doesn't fit. until then, a
+    // rectangle replaces the parts of earlier ones that it covers, so a
+    // client sending frames faster than they're drawn skips the stale ones
+    // instead of waiting for them.
+    struct display_job *job = NULL;
+    struct display_job *drawn;
+    uint8_t error_status = RECT_OK;
+    bool ok = true;
+
+    while (ok) {
+        const bool readable = wait_readable(client_sock, 0);
+
+        // batch up rectangles the client has already sent, but don't keep
+        // it waiting for the ones it has
+        if (job && job->list.num_chunks > 0 && !readable) {
+            draw_job(job);
+            job = NULL;
+        }
+
+        // acknowledge what's been drawn. a client with nothing more to send
+        // may be waiting for that, so don't block in recv while it is drawn.
+        drawn = reclaim_job(readable ? 0 : ACK_POLL_MS / portTICK_PERIOD_MS);
+        if (drawn) {
+            ok = ack_rects(client_sock, drawn);
+            continue;
+        }
+        if (!readable && num_drawing_jobs > 0) {
+            continue;
+        }
+
+        // nothing's being drawn, so if the client stays quiet for a moment,
+        // clean up after its fast or partial updates
+        if (!readable && ghost_over(GHOST_BUDGET)
+            && !wait_readable(client_sock, GHOST_IDLE_MS) && clean_ghosts())
+        {
+            continue;
+        }
+
+        struct rect_header rh;
+        struct frame_header fh;
+        if (!recv_rect_header(client_sock, framed, seq, &rh, &fh,
+            &error_status))
+        {
+            ok = false;
+            break;
+        }
+
+        if (RECT_OK != error_status) {
+            break;
+        }
+
+        if (0 == rh.w || 0 == rh.h) {
+            // end of list
+            break;
+        }
+
+        error_status = chunk_check_rect(&rh);
+        if (RECT_OK != error_status) {
+            printf("bad rect %d,%d %dx%d\n", rh.x, rh.y, rh.w, rh.h);
+            // a framed header's CRC is only checked once its chunk is in,
+            // so one that doesn't fit may just be damaged: have it resent
+            if (framed) {
+                error_status = RECT_NAK;
+            }
+            break;
+        }
+
+        const int byte_w = BITMAP_ROW_SIZE(rh.w);
+        const int size = rh.h * byte_w;
+
+        const struct eink_region region = {
+            .x0 = SCREEN_BITMAP_X_OFS + rh.x,
+            .y0 = SCREEN_BITMAP_Y_OFS + rh.y,
+            .x1 = SCREEN_BITMAP_X_OFS + rh.x + rh.w,
+            .y1 = SCREEN_BITMAP_Y_OFS + rh.y + rh.h,
+        };
+
+        if (job && (job->size + size > CHUNK_BUF_SIZE
+            || chunk_list_count_cover(&job->list, &region)
+                >= EINK_MAX_REGIONS
+            || job->num_rects >= MAX_JOB_RECTS))
+        {
+            draw_job(job);
+            job = NULL;
+        }
+
+        if (!job) {
+            if (0 == num_free_jobs) {
+                ok = ack_rects(client_sock, reclaim_job(portMAX_DELAY));
+            }
+            job = take_job();
+        }
+
+        if (!ok) {
+            break;
+        }
+        const int ofs = job->size;
+
+        // the header's CRC, up to the crc field, goes on over the chunk
+        if (framed) {
+            recv_check_start(true,
+                crc32_update(0, &fh, offsetof(struct frame_header, crc)),
+                fh.length);
+        } else {
+            recv_check_start(false, 0, 0);
+        }
+
+        // a framed chunk that doesn't decode is as damaged as one that fails
+        // its CRC. if the connection is what broke, the NAK goes nowhere.
+        const bool received = recv_chunk(client_sock, encoded, has_old,
+            job->buf, ofs, size);
+        if (!received && !framed) {
+            ok = false;
+            break;
+        }
+
+        if (framed && (!received || fh.length != recv_count
+            || fh.crc != recv_crc))
+        {
+            printf("frame %u damaged\n", seq);
+            error_status = RECT_NAK;
+            break;
+        }
+
+        chunk_list_cover(&job->list, &region);
+        if (0 == job->num_rects) {
+            job->mode = mode;
+            job->framed = framed;
+            job->first_seq = seq;
+        }
+        ++job->num_rects;
+        ++seq;
+
+        const int i = job->list.num_chunks++;
+        job->list.regions[i] = region;
+        job->list.chunks[i] = (struct chunk_params){
+            .buf = job->buf,
+            .has_old = has_old,
+            .x = region.x0,
+            .y = region.y0,
+            .byte_w = byte_w,
+            .ofs = ofs,
+        };
+        job->size += size;
+    }
+
+    // draw what's been received, unless the connection broke. framed
+    // rectangles are checked as they arrive, so those are drawn anyway, and
+    // the client doesn't send them again when it resumes.
+    if (job) {
+        if ((ok || framed) && job->list.num_chunks > 0) {
+            draw_job(job);
+        } else {
+            put_job(job);
+        }
+    }
+
+    while ((drawn = reclaim_job(portMAX_DELAY))) {
+        ok = ok && ack_rects(client_sock, drawn);
+    }
+
+    if (RECT_NAK == error_status) {
+        perf_count(PERF_FRAME_NAKS, 1);
+    }
+
+    if (ok && RECT_OK != error_status) {
+        if (framed) {
+            const struct frame_ack ack = { seq, error_status };
+            if (sendall(client_sock, (void*)&ack, sizeof(ack))
+                && RECT_NAK == error_status)
+            {
+                drain(client_sock);
+            }
+        } else {
+            sendall(client_sock, &error_status, sizeof(error_status));
+        }
+    }
+
+    // the client has had its statuses, so it isn't kept waiting for this
+    if (clean_ghosts()) {
+        reclaim_job(portMAX_DELAY);
+    }
+}
+
+// sends the perf counters as described for PROTO_CMD_STATS
+#define STATS_LINE_SIZE 384
+
+static void handle_stats(int client_sock)
+{
+    char line[STATS_LINE_SIZE];
+
+    for (int i = 0; i < NUM_PERF_HISTS; ++i) {
+        const struct perf_hist *h = &perf_hists[i];
+
+        int num_buckets = PERF_HIST_BUCKETS;
+        while (num_buckets > 0 && 0 == h->buckets[num_buckets - 1]) {
+            --num_buckets;
+        }
+
+        int n = snprintf(line, sizeof(line), "%s n %u sum_ms %u max_us %u hist",
+            perf_hist_names[i], h->count, (uint32_t)(h->sum_us / 1000),
+            h->max_us);
+        for (int b = 0; b < num_buckets; ++b) {
+            n += snprintf(line + n, sizeof(line) - n, " %u", h->buckets[b]);
+        }
+        n += snprintf(line + n, sizeof(line) - n, "\n");
+
+        if (!sendall(client_sock, (void*)line, n))
+            return;
+    }
+
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+        int n = snprintf(line, sizeof(line), "%s %u\n",
+            perf_counter_names[i], perf_counters[i]);
+        if (!sendall(client_sock, (void*)line, n))
+            return;
+    }
+
+    int n = snprintf(line, sizeof(line),
+        "uptime_s %u\nwaveform_crc %u\npowered %d\nfree_heap %u\n",
+        xTaskGetTickCount() / (1000 / portTICK_PERIOD_MS),
+        waveform_file_crc(), powered, xPortGetFreeHeapSize());
+    sendall(client_sock, (void*)line, n);
+}
+
+// replaces the waveforms as described for PROTO_CMD_WAVEFORM. the file is
+// received into a job's buffer, which the display task switches to between
+// updates.
+static void handle_waveform(int client_sock)
+{
+    uint32_t size;
+    if (!recvall(client_sock, (void*)&size, sizeof(size)))
+        return;
+
+    uint8_t status = WAVEFORM_ERR_BAD;
+    if (size <= WAVEFORM_FILE_MAX_SIZE) {
+        struct display_job *job = take_job();
+        if (!recvall(client_sock, job->buf->new_bits, size)) {
+            put_job(job);
+            return;
+        }
+
+        const bool good = 0 == size
+            || waveform_file_check(job->buf->new_bits, size);
+        if (good && !waveform_store_write(job->buf->new_bits, size)) {
+            status = WAVEFORM_ERR_FLASH;
+        } else if (good) {
+            job->waveform = true;
+            job->size = size;
+            draw_job(job);
+            job = NULL;
+            reclaim_job(portMAX_DELAY);
+            status = WAVEFORM_OK;
+        }
+        if (job) {
+            put_job(job);
+        }
+    }
+
+    printf("waveform file of %u bytes: status %u\n", size, status);
+    sendall(client_sock, &status, sizeof(status));
+}
+
+void handle_conn(int client_sock)
+{
+    const TickType_t start_ticks = xTaskGetTickCount();
+    int cmd = read_command(client_sock);
+
+    enum EINK_MODE mode = EINK_MODE_FULL;
+    if (PROTO_CMD_FAST == cmd || PROTO_CMD_PARTIAL == cmd) {
+        mode = (PROTO_CMD_FAST == cmd) ? EINK_MODE_FAST : EINK_MODE_PARTIAL;
+        cmd = read_command(client_sock);
+    }
+
+    if (PROTO_CMD_STATS == cmd) {
+        handle_stats(client_sock);
+    } else if (PROTO_CMD_WAVEFORM == cmd) {
+        handle_waveform(client_sock);
+    } else if (CMD_CLOSED != cmd) {
+        power_up();
+        printf("here we go!\n");
+
+        if (PROTO_CMD_FRAMED != cmd) {
+            have_transfer = false;
+        }
+
+        switch (cmd) {
+        case CMD_NONE:
+        case PROTO_CMD_TILES_ENCODED:
+            handle_tiles(client_sock, PROTO_CMD_TILES_ENCODED == cmd, mode);
+            break;
+
+        case PROTO_CMD_RECTS:
+        case PROTO_CMD_RECTS_ENCODED:
+            handle_rects(client_sock, PROTO_CMD_RECTS_ENCODED == cmd, true,
+                false, mode);
+            break;
+
+        case PROTO_CMD_RECTS_NEW:
+        case PROTO_CMD_RECTS_NEW_ENCODED:
+            handle_rects(client_sock, PROTO_CMD_RECTS_NEW_ENCODED == cmd,
+                false, false, mode);
+            break;
+
+        case PROTO_CMD_FRAMED:
+            handle_rects(client_sock, true, false, true, mode);
+            break;
+
+        default:
+            printf("unknown command %d\n", cmd);
+            break;
+        }
+
+        power_idle();
+    }
 
     lwip_close(client_sock);
+
+    perf_record_us(PERF_CONN,
+        (xTaskGetTickCount() - start_ticks) * portTICK_PERIOD_MS * 1000);
 }
 
 static bool connect_to_wifi(struct ip_info *info_ptr)
@@ -168,13 +839,32 @@ void main_thread(void *arg)
     lwip_listen(listen_sock, 5);
 
     printf("clearing screen...\n");
-    eink_power_on();
+    power_up();
     eink_refresh(WHITE);
-    eink_power_off();
-
+    shadow_fill(WHITE);
+    power_idle();
+
+    struct eink_timing t;
+    eink_get_timing(&t);
+    printf("timing: %uMHz, SR write %uns, CKV high %uns (asked %uns), "
+        "low %uns (asked %uns)\n", t.cpu_mhz, t.sr_write_ns,
+        t.ckv_high_ns, t.ckv_high_requested_ns,
+        t.ckv_low_ns, t.ckv_low_requested_ns);
+
+    // with WiFi and lwIP up, what's left of the RAM budget in chunk.h
+    printf("free heap %u bytes\n", xPortGetFreeHeapSize());
     printf("listening...\n");
 
     for (;;) {
+        // with the rails up, only wait for a connection until they've been
+        // idle long enough to drop. connections that don't draw, like
+        // PROTO_CMD_STATS, don't keep them up.
+        const int idle_left_ms = power_idle_left_ms();
+        if (idle_left_ms >= 0 && !wait_readable(listen_sock, idle_left_ms)) {
+            power_down();
+            continue;
+        }
+
         struct sockaddr_in client_addr;
         socklen_t client_addrlen = sizeof(client_addr);
         int client_sock = lwip_accept(listen_sock,
@@ -213,6 +903,28 @@ void user_init(void)
         return;
     }
 
+    size_t waveform_size;
+    const void *waveform_data = waveform_store_read(&waveform_size);
+    if (waveform_data && !eink_load_waveforms(waveform_data, waveform_size)) {
+        printf("stored waveforms are bad, using the built in ones\n");
+    }
+#if THERMISTOR
+    eink_set_temp_source(thermistor_read_temp, NULL);
+#endif
+
+    if (!display_setup()) {
+        printf("display setup fail\n");
+        return;
+    }
+
+    for (int i = 0; i < NUM_DISPLAY_JOBS; ++i) {
+        put_job(&display_jobs[i]);
+    }
+
+    struct eink_timing t;
+    eink_get_timing(&t);
+    perf_set_cpu_mhz(t.cpu_mhz);
+
     printf("hw setup ok\n");
 
     int err = xTaskCreate(main_thread, "listen", 512, NULL, 1, NULL);
@@ -0,0 +1,52 @@
+#include "perf.h"
+
+
+struct perf_hist perf_hists[NUM_PERF_HISTS];
+uint32_t perf_counters[NUM_PERF_COUNTERS];
+
+const char *const perf_hist_names[NUM_PERF_HISTS] = {
+    [PERF_UPDATE_STAGE] = "update_stage",
+    [PERF_REFRESH_STAGE] = "refresh_stage",
+    [PERF_ROW_ENCODE] = "row_encode",
+    [PERF_POWER_ON] = "power_on",
+    [PERF_NET_WAIT] = "net_wait",
+    [PERF_CONN] = "conn",
+};
+
+const char *const perf_counter_names[NUM_PERF_COUNTERS] = {
+    [PERF_BYTES_RECEIVED] = "bytes_received",
+    [PERF_FRAME_NAKS] = "frame_naks",
+    [PERF_GHOST_CLEANS] = "ghost_cleans",
+    [PERF_POWER_UPS] = "power_ups",
+    [PERF_POWER_DOWNS] = "power_downs",
+};
+
+static uint32_t cycles_per_us = 80;
+
+
+void perf_set_cpu_mhz(uint32_t mhz)
+{
+    cycles_per_us = mhz;
+}
+
+void perf_record(enum PERF_HIST hist, uint32_t start)
+{
+    perf_record_us(hist, (eink_hal_ccount() - start) / cycles_per_us);
+}
+
+void perf_record_us(enum PERF_HIST hist, uint32_t us)
+{
+    struct perf_hist *h = &perf_hists[hist];
+
+    int bucket = 0;
+    while (bucket < PERF_HIST_BUCKETS - 1 && (us >> bucket) != 0) {
+        ++bucket;
+    }
+
+    ++h->count;
+    h->sum_us += us;
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+    ++h->buckets[bucket];
+}
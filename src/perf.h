@@ -0,0 +1,78 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+
+// counters and latency histograms kept while running, for finding out where
+// update time goes on boards in the field. times come from the cycle counter
+// and are kept in microseconds.
+
+
+#include <stdint.h>
+#include "eink_hal.h"
+
+
+enum PERF_HIST {
+    // one waveform stage's scan of the panel
+    PERF_UPDATE_STAGE = 0,
+    PERF_REFRESH_STAGE,
+    // getting and encoding one row's drive bytes
+    PERF_ROW_ENCODE,
+    PERF_POWER_ON,
+    // one recvall, most of which is waiting for the network
+    PERF_NET_WAIT,
+    // one connection, from accept to close
+    PERF_CONN,
+    NUM_PERF_HISTS,
+};
+
+enum PERF_COUNTER {
+    PERF_BYTES_RECEIVED = 0,
+    // PROTO_CMD_FRAMED rectangles answered with RECT_NAK
+    PERF_FRAME_NAKS,
+    // full updates cleaning up after fast ones
+    PERF_GHOST_CLEANS,
+    // the panel's rails coming up and going down; see POWER_IDLE_MS
+    PERF_POWER_UPS,
+    PERF_POWER_DOWNS,
+    NUM_PERF_COUNTERS,
+};
+
+// bucket i counts times under 2^i us and, past bucket 0, at least
+// 2^(i - 1) us. the last bucket also counts everything longer.
+#define PERF_HIST_BUCKETS 24
+
+struct perf_hist {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[PERF_HIST_BUCKETS];
+};
+
+extern struct perf_hist perf_hists[NUM_PERF_HISTS];
+extern uint32_t perf_counters[NUM_PERF_COUNTERS];
+
+extern const char *const perf_hist_names[NUM_PERF_HISTS];
+extern const char *const perf_counter_names[NUM_PERF_COUNTERS];
+
+
+// the cycle counter rate, from eink_get_timing. 80 until set.
+void perf_set_cpu_mhz(uint32_t mhz);
+
+static inline uint32_t perf_start(void)
+{
+    return eink_hal_ccount();
+}
+
+// records the time since start, a perf_start() value. the cycle counter
+// wraps after 2^32 cycles (53s at 80MHz), so anything that can take longer
+// should use perf_record_us.
+void perf_record(enum PERF_HIST hist, uint32_t start);
+void perf_record_us(enum PERF_HIST hist, uint32_t us);
+
+static inline void perf_count(enum PERF_COUNTER counter, uint32_t n)
+{
+    perf_counters[counter] += n;
+}
+
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+
+// wire protocol on LISTEN_PORT, shared by the device and the host tools.
+// all integers are sent in the device's byte order (little endian).
+//
+// bitmaps are rows of BITMAP_ROW_SIZE(w) bytes, with the device's
+// PIXEL_BIT_SIZE bits per pixel.
+//
+// a client that sends nothing after connecting gets the tile protocol: the
+// device walks the screen in CHUNK_WIDTH x CHUNK_HEIGHT tiles, and for each
+// one sends its x, y, w, h as int32s and reads back the tile's old rows and
+// then its new rows.
+//
+// otherwise the client starts with one of the command bytes below.
+
+
+#include <stdint.h>
+
+
+#define LISTEN_PORT 3124
+
+// how long the device waits for a command before assuming a tile protocol
+// client
+#define CMD_WAIT_MS 100
+
+
+enum PROTO_CMD {
+    // rectangle list: the device sends a struct rects_hello, then the client
+    // sends any number of rectangles, each a struct rect_header followed by
+    // its old rows and then its new rows. the device answers each rectangle
+    // with a one byte enum RECT_STATUS once it is drawn. a header with w or h
+    // of 0 ends the list.
+    // rectangles that arrive back to back are drawn together in one set of
+    // scans, as long as they fit in the device's buffer, so clients should
+    // send all of them before waiting for the statuses.
+    // a rectangle that overlaps ones still waiting to be drawn replaces the
+    // parts of them it covers. a client can stream frames on one connection
+    // without waiting, and while the panel is busy only the latest gets
+    // drawn. replaced rectangles are answered once what replaced them is
+    // drawn.
+    PROTO_CMD_RECTS = 'R',
+
+    // like the tile protocol and PROTO_CMD_RECTS, except that each tile's or
+    // rectangle's bitmaps are sent as a struct chunk_header and its payload
+    PROTO_CMD_TILES_ENCODED = 'T',
+    PROTO_CMD_RECTS_ENCODED = 'E',
+
+    // like PROTO_CMD_RECTS and PROTO_CMD_RECTS_ENCODED, except that only the
+    // new rows are sent. the device keeps its own copy of what it has drawn,
+    // so clients don't need one. encoded rectangles are CHUNK_RAW with just
+    // the new rows, or CHUNK_RLE_XOR with old_size 0.
+    // the other commands send old rows too, but the device only falls back on
+    // them for rows it doesn't have a copy of.
+    PROTO_CMD_RECTS_NEW = 'N',
+    PROTO_CMD_RECTS_NEW_ENCODED = 'M',
+
+    // like PROTO_CMD_RECTS_NEW_ENCODED, but each rectangle is a struct
+    // frame_header followed by its struct chunk_header and payload, so a
+    // damaged or lost one is caught, and a transfer cut off by a dropped
+    // connection can be picked up where it stopped.
+    // the client starts with a uint32 transfer id of its choosing, and the
+    // device answers with a struct framed_hello. rectangles are numbered
+    // from 0 through the whole transfer, and the client sends them from
+    // resume_seq on: earlier ones of the same transfer are already drawn.
+    // each rectangle is answered with a struct frame_ack once it is drawn,
+    // and the list ends with a header with w or h of 0.
+    // a rectangle that fails its CRC, or doesn't have the expected seq, is
+    // answered with RECT_NAK. the device draws the rectangles before it,
+    // acknowledges them and closes the connection, and the client should
+    // reconnect with the same transfer id and resume. the device only
+    // remembers the last transfer, and only until it restarts or another
+    // command draws. a rectangle outside the screen or too big is NAKed
+    // too, as its header may be what's damaged.
+    PROTO_CMD_FRAMED = 'F',
+
+    // sent before another command byte: the connection's tiles or
+    // rectangles are drawn with the fast waveform, which only drives pixels
+    // that change, and draws grey levels as the nearer of black and white.
+    // it's much quicker and doesn't flash, for typing, menus and the like,
+    // but leaves some ghosting. the device keeps count, and once an area has
+    // had too many fast updates, it redraws it with the full waveform when
+    // the client goes quiet for a moment, or straight away if it doesn't.
+    PROTO_CMD_FAST = 'Q',
+
+    // like PROTO_CMD_FAST, but with the full waveform for the pixels that
+    // change. pixels that don't aren't driven, so only the changes flash,
+    // and rows without any changes are skipped. grey levels come out right.
+    // this counts towards the same ghosting budget.
+    PROTO_CMD_PARTIAL = 'P',
+
+    // the device sends its performance counters and histograms as text and
+    // closes the connection, without touching the panel. one line per
+    // histogram: "<name> n <count> sum_ms <sum> max_us <max> hist <b0> <b1>
+    // ...", where bucket i counts times under 2^i us (and at least
+    // 2^(i - 1) us past b0), up to the last non-empty one. then one
+    // "<name> <value>" line per counter, "uptime_s <seconds>",
+    // "waveform_crc <crc>", the CRC of the waveform file in use, or 0 for
+    // the built in waveforms, "powered <1 or 0>", whether the panel's
+    // rails are up, and "free_heap <bytes>".
+    PROTO_CMD_STATS = 'S',
+
+    // replaces the device's waveforms: the client sends a uint32 size and
+    // then a waveform file of that size (see src/waveform.h), and the device
+    // answers with a one byte enum WAVEFORM_STATUS and closes the
+    // connection. a good file is stored in flash, where it's loaded from at
+    // startup, and used from the next update on. a size of 0 goes back to
+    // the built in waveforms. a file that fails its checks changes nothing.
+    PROTO_CMD_WAVEFORM = 'W',
+};
+
+
+struct rects_hello {
+    // max bytes of a rectangle's old (or new) bitmap, h * BITMAP_ROW_SIZE(w)
+    int32_t max_bitmap_size;
+    // PIXEL_BIT_SIZE
+    int32_t pixel_bits;
+};
+
+struct rect_header {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+};
+
+struct framed_hello {
+    struct rects_hello rects;
+    // the first rectangle of the transfer that the device hasn't drawn; 0
+    // for a new transfer
+    uint32_t resume_seq;
+};
+
+// "FRME", to catch a stream that has lost its place
+#define FRAME_MAGIC 0x454d5246
+
+struct frame_header {
+    uint32_t magic;
+    uint32_t seq;
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+    // bytes after the header: the struct chunk_header and its payload
+    uint32_t length;
+    // crc32_update() of the header up to here, then of the length bytes
+    // after it
+    uint32_t crc;
+};
+
+struct frame_ack {
+    uint32_t seq;
+    // an enum RECT_STATUS
+    int32_t status;
+};
+
+enum RECT_STATUS {
+    RECT_OK = 0,
+    // the rectangle isn't inside the screen; the device closes the connection.
+    // with PROTO_CMD_FRAMED, RECT_NAK instead.
+    RECT_ERR_BOUNDS,
+    // the bitmaps are bigger than max_bitmap_size; the device closes the
+    // connection. with PROTO_CMD_FRAMED, RECT_NAK instead.
+    RECT_ERR_SIZE,
+    // PROTO_CMD_FRAMED only: the rectangle arrived damaged or out of order;
+    // the device closes the connection
+    RECT_NAK,
+};
+
+
+
+enum WAVEFORM_STATUS {
+    WAVEFORM_OK = 0,
+    // the file is too big, truncated, fails its CRC, or is for another
+    // PIXEL_BIT_SIZE or version
+    WAVEFORM_ERR_BAD,
+    // storing it failed; the device goes on with the waveforms it had
+    WAVEFORM_ERR_FLASH,
+};
+
+
+enum CHUNK_ENCODING {
+    // old rows, then new rows, as in the plain protocols
+    CHUNK_RAW = 0,
+    // old_size bytes of rle_encode()d old rows, then delta_size bytes of
+    // rle_encode()d old XOR new rows. each covers all of the chunk's rows
+    // back to back.
+    CHUNK_RLE_XOR,
+};
+
+struct chunk_header {
+    int32_t encoding;
+    // payload sizes, for CHUNK_RLE_XOR
+    int32_t old_size;
+    int32_t delta_size;
+};
+
+
+#endif
@@ -0,0 +1,143 @@
+#include <string.h>
+#include "rle.h"
+
+
+enum RLE_STATE {
+    RLE_CONTROL,
+    RLE_LITERAL,
+    RLE_RUN_VALUE,
+    RLE_RUN,
+};
+
+
+// length of the run of equal bytes at the start of src
+static size_t run_length(const uint8_t *src, size_t len)
+{
+    size_t n = 1;
+    while (n < len && n < RLE_MAX_RUN && src[n] == src[0]) {
+        ++n;
+    }
+    return n;
+}
+
+size_t rle_encode(const uint8_t *src, size_t len, uint8_t *dst,
+    size_t dst_size)
+{
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        size_t run = run_length(src + i, len - i);
+        if (run >= RLE_MIN_RUN) {
+            if (out + 2 > dst_size) {
+                return 0;
+            }
+            dst[out++] = 0x80 | (run - RLE_MIN_RUN);
+            dst[out++] = src[i];
+            i += run;
+            continue;
+        }
+
+        // literal up to the next run worth encoding
+        size_t lit = 0;
+        while (i + lit < len && lit < RLE_MAX_LITERAL
+            && run_length(src + i + lit, len - i - lit) < RLE_MIN_RUN)
+        {
+            ++lit;
+        }
+
+        if (out + 1 + lit > dst_size) {
+            return 0;
+        }
+        dst[out++] = lit - 1;
+        memcpy(dst + out, src + i, lit);
+        out += lit;
+        i += lit;
+    }
+
+    return out;
+}
+
+
+void rle_decoder_init(struct rle_decoder *dec)
+{
+    dec->state = RLE_CONTROL;
+    dec->count = 0;
+    dec->value = 0;
+}
+
+size_t rle_decode(struct rle_decoder *dec,
+    const uint8_t **src, size_t src_len, uint8_t **dst, size_t dst_len)
+{
+    const uint8_t *in = *src;
+    const uint8_t *in_end = in + src_len;
+    uint8_t *out = *dst;
+    uint8_t *out_end = out + dst_len;
+
+    while (out < out_end) {
+        if (RLE_RUN == dec->state) {
+            size_t n = dec->count;
+            if (n > out_end - out) {
+                n = out_end - out;
+            }
+            memset(out, dec->value, n);
+            out += n;
+            dec->count -= n;
+            if (0 == dec->count) {
+                dec->state = RLE_CONTROL;
+            }
+            continue;
+        }
+
+        if (in == in_end) {
+            break;
+        }
+
+        switch (dec->state) {
+        case RLE_CONTROL: {
+            const uint8_t c = *in++;
+            if (c & 0x80) {
+                dec->count = (c & 0x7f) + RLE_MIN_RUN;
+                dec->state = RLE_RUN_VALUE;
+            } else {
+                dec->count = c + 1;
+                dec->state = RLE_LITERAL;
+            }
+            break;
+        }
+
+        case RLE_LITERAL: {
+            size_t n = dec->count;
+            if (n > out_end - out) {
+                n = out_end - out;
+            }
+            if (n > in_end - in) {
+                n = in_end - in;
+            }
+            memcpy(out, in, n);
+            out += n;
+            in += n;
+            dec->count -= n;
+            if (0 == dec->count) {
+                dec->state = RLE_CONTROL;
+            }
+            break;
+        }
+
+        case RLE_RUN_VALUE:
+            dec->value = *in++;
+            dec->state = RLE_RUN;
+            break;
+        }
+    }
+
+    const size_t written = out - *dst;
+    *src = in;
+    *dst = out;
+    return written;
+}
+
+bool rle_decoder_done(const struct rle_decoder *dec)
+{
+    return RLE_CONTROL == dec->state;
+}
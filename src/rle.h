@@ -0,0 +1,52 @@
+#ifndef __RLE_H__
+#define __RLE_H__
+
+
+// byte oriented run-length coding, used on the wire and for bitmaps kept in
+// RAM. the encoding is a sequence of:
+//  - a control byte c < 0x80, followed by c + 1 literal bytes
+//  - a control byte c >= 0x80, followed by one byte repeated
+//    (c & 0x7f) + RLE_MIN_RUN times
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define RLE_MIN_RUN     3
+#define RLE_MAX_RUN     (0x7f + RLE_MIN_RUN)
+#define RLE_MAX_LITERAL 0x80
+
+// worst case encoded size of len bytes
+#define RLE_MAX_ENCODED_SIZE(len) \
+    ((len) + ((len) + RLE_MAX_LITERAL - 1) / RLE_MAX_LITERAL)
+
+
+// encodes len bytes of src into dst. returns the encoded size, or 0 if it
+// doesn't fit in dst_size bytes.
+size_t rle_encode(const uint8_t *src, size_t len, uint8_t *dst,
+    size_t dst_size);
+
+
+// decodes an encoding that may arrive in pieces
+struct rle_decoder {
+    uint8_t state;
+    // bytes left in the current literal or run
+    uint8_t count;
+    uint8_t value;
+};
+
+void rle_decoder_init(struct rle_decoder *dec);
+
+// decodes from *src (src_len bytes) into *dst (dst_len bytes) until either
+// runs out, advancing both. returns the number of bytes written.
+size_t rle_decode(struct rle_decoder *dec,
+    const uint8_t **src, size_t src_len, uint8_t **dst, size_t dst_len);
+
+// returns true if the decoder is between two runs or literals, i.e. it
+// doesn't expect any more input for the bytes it has written
+bool rle_decoder_done(const struct rle_decoder *dec);
+
+
+#endif
@@ -0,0 +1,253 @@
+#include <string.h>
+#include "rle.h"
+#include "shadow.h"
+
+
+#define SHADOW_ROW_SIZE MAX_BITMAP_ROW_SIZE
+
+// struct shadow_row sizes that aren't an encoding's size. anything else is
+// an rle_encode()d row, or a raw one if it's SHADOW_ROW_SIZE. rows start
+// out zeroed, so unknown.
+#define ROW_UNKNOWN 0
+#define ROW_BLANK   0xffff
+
+struct shadow_row {
+    // of the row's data in pool
+    uint16_t ofs;
+    uint16_t size;
+};
+
+static struct shadow_row rows[SCREEN_HEIGHT];
+
+// rows are appended at pool_used, each as a struct pool_entry and its data.
+// an entry is garbage once its row is stored again or forgotten.
+struct pool_entry {
+    uint16_t y;
+    uint16_t size;
+};
+
+#if SHADOW_POOL_SIZE > 0xffff
+#error SHADOW_POOL_SIZE must fit struct shadow_row offsets
+#endif
+
+static uint8_t pool[SHADOW_POOL_SIZE];
+static int pool_used;
+// bytes of pool_used that are garbage
+static int pool_garbage;
+
+// the last row read or written, decoded
+static uint8_t cached_row[SHADOW_ROW_SIZE];
+static int cached_y = -1;
+
+
+static bool is_live_entry(int ofs, const struct pool_entry *e)
+{
+    const struct shadow_row *r = &rows[e->y];
+    return r->ofs == ofs + sizeof(*e) && r->size == e->size;
+}
+
+// moves the live entries down over the garbage
+static void compact_pool(void)
+{
+    int dst = 0;
+    for (int src = 0; src < pool_used;) {
+        struct pool_entry e;
+        memcpy(&e, pool + src, sizeof(e));
+        const int entry_size = sizeof(e) + e.size;
+
+        if (is_live_entry(src, &e)) {
+            memmove(pool + dst, pool + src, entry_size);
+            rows[e.y].ofs = dst + sizeof(e);
+            dst += entry_size;
+        }
+        src += entry_size;
+    }
+    pool_used = dst;
+    pool_garbage = 0;
+}
+
+static bool is_pooled(const struct shadow_row *r)
+{
+    return ROW_UNKNOWN != r->size && ROW_BLANK != r->size;
+}
+
+// makes row y unknown, leaving its entry as garbage
+static void drop_row(int y)
+{
+    struct shadow_row *r = &rows[y];
+    if (is_pooled(r)) {
+        pool_garbage += sizeof(struct pool_entry) + r->size;
+    }
+    r->size = ROW_UNKNOWN;
+}
+
+static bool is_blank_row(const uint8_t *row)
+{
+    for (int i = 0; i < SHADOW_ROW_SIZE; ++i) {
+        if (WHITE != row[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// decodes row y into cached_row. returns NULL if it's unknown.
+static uint8_t *load_row(int y)
+{
+    if (y == cached_y) {
+        return cached_row;
+    }
+
+    const struct shadow_row *r = &rows[y];
+    const uint8_t *data = pool + r->ofs;
+
+    // in case decoding fails part way
+    cached_y = -1;
+
+    switch (r->size) {
+    case ROW_UNKNOWN:
+        return NULL;
+
+    case ROW_BLANK:
+        memset(cached_row, WHITE, SHADOW_ROW_SIZE);
+        break;
+
+    case SHADOW_ROW_SIZE:
+        memcpy(cached_row, data, SHADOW_ROW_SIZE);
+        break;
+
+    default: {
+        struct rle_decoder dec;
+        rle_decoder_init(&dec);
+        uint8_t *dst = cached_row;
+        if (SHADOW_ROW_SIZE != rle_decode(&dec, &data, r->size,
+            &dst, SHADOW_ROW_SIZE))
+        {
+            return NULL;
+        }
+        break;
+    }
+    }
+
+    cached_y = y;
+    return cached_row;
+}
+
+// stores cached_row as row y
+static void store_row(int y)
+{
+    cached_y = y;
+    drop_row(y);
+
+    if (is_blank_row(cached_row)) {
+        rows[y].size = ROW_BLANK;
+        return;
+    }
+
+    // only worth encoding if it comes out smaller
+    static uint8_t enc[SHADOW_ROW_SIZE - 1];
+    int size = rle_encode(cached_row, SHADOW_ROW_SIZE, enc, sizeof(enc));
+    const uint8_t *data = enc;
+    if (0 == size) {
+        size = SHADOW_ROW_SIZE;
+        data = cached_row;
+    }
+
+    const struct pool_entry e = {
+        .y = y,
+        .size = size,
+    };
+    const int entry_size = sizeof(e) + size;
+
+    if (pool_used + entry_size > SHADOW_POOL_SIZE) {
+        if (pool_used - pool_garbage + entry_size > SHADOW_POOL_SIZE) {
+            // the row stays unknown
+            return;
+        }
+        compact_pool();
+    }
+
+    memcpy(pool + pool_used, &e, sizeof(e));
+    memcpy(pool + pool_used + sizeof(e), data, size);
+    rows[y].ofs = pool_used + sizeof(e);
+    rows[y].size = size;
+    pool_used += entry_size;
+}
+
+
+void shadow_fill(pixel_t pixel)
+{
+    memset(rows, 0, sizeof(rows));
+    pool_used = 0;
+    pool_garbage = 0;
+    cached_y = -1;
+
+    uint8_t b = 0;
+    for (int i = 0; i < PIXELS_PER_BYTE; ++i) {
+        b = (b << PIXEL_BIT_SIZE) | (pixel & PIXEL_BITMASK);
+    }
+
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        memset(cached_row, b, SHADOW_ROW_SIZE);
+        store_row(y);
+    }
+}
+
+const uint8_t *shadow_get_row(int y)
+{
+    return load_row(y);
+}
+
+bool shadow_get_span(int y, int x0, int x1, uint8_t *bits)
+{
+    const uint8_t *row = load_row(y);
+    if (!row) {
+        return false;
+    }
+
+    copy_row_pixels(bits, 0, row, x0, x1 - x0);
+    return true;
+}
+
+void shadow_put_span(int y, int x0, int x1, const uint8_t *bits)
+{
+    uint8_t *row = load_row(y);
+    if (!row) {
+        if (x0 > 0 || x1 < SCREEN_WIDTH) {
+            // the rest of the row is still unknown
+            return;
+        }
+        row = cached_row;
+    }
+
+    copy_row_pixels(row, x0, bits, 0, x1 - x0);
+    store_row(y);
+}
+
+void shadow_forget_row(int y)
+{
+    drop_row(y);
+    if (y == cached_y) {
+        cached_y = -1;
+    }
+}
+
+bool shadow_row_known(int y)
+{
+    return y == cached_y || ROW_UNKNOWN != rows[y].size;
+}
+
+bool shadow_get_rows(void *arg, int y, int x0, int x1,
+    struct eink_row_span *span)
+{
+    const uint8_t *row = load_row(y);
+    if (!row) {
+        return false;
+    }
+
+    span->old_row = row;
+    span->new_row = row;
+    span->old_x = x0;
+    span->new_x = x0;
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef __SHADOW_H__
+#define __SHADOW_H__
+
+
+// a compressed copy of what's on the panel, so the old rows of an update can
+// come from the device itself rather than from the client.
+// each row is kept rle_encode()d in a pool, or raw if that isn't smaller, or
+// not at all if it's all WHITE. a row that doesn't fit even after compacting
+// the pool is forgotten, and is unknown until it's drawn in full again.
+// rows start out unknown.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "eink.h"
+
+
+// bytes of stored rows. a mostly white screen at 1bpp fits in a few KB; rows
+// that don't fit are driven as if unknown. counts towards the RAM budget in
+// chunk.h.
+#ifndef SHADOW_POOL_SIZE
+#define SHADOW_POOL_SIZE 8192
+#endif
+
+
+// the whole panel has been set to pixel, as by eink_refresh
+void shadow_fill(pixel_t pixel);
+
+// copies pixels x0..x1 of row y into bits, starting at its first pixel.
+// returns false if the row is unknown.
+bool shadow_get_span(int y, int x0, int x1, uint8_t *bits);
+
+// row y, decoded, without copying it. it stays put until the shadow is next
+// used. returns NULL if the row is unknown.
+const uint8_t *shadow_get_row(int y);
+
+// pixels x0..x1 of row y have been drawn from bits, starting at its first
+// pixel
+void shadow_put_span(int y, int x0, int x1, const uint8_t *bits);
+
+// row y may not have been drawn as asked
+void shadow_forget_row(int y);
+
+// whether shadow_get_span would find row y
+bool shadow_row_known(int y);
+
+// get_row_span_cb_t that points both the old and the new rows at the
+// shadow's, for redrawing what's there. stops at rows it doesn't know. arg
+// is unused.
+bool shadow_get_rows(void *arg, int y, int x0, int x1,
+    struct eink_row_span *span);
+
+
+#endif
@@ -1,21 +1,47 @@
+#include <stdint.h>
 #include <lwip/sockets.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "perf.h"
 #include "skall.h"
 
 
+// the cycle counter wraps after 26s at 160MHz, and an idle client can keep
+// recv waiting for hours. waits that long are timed in ticks instead.
+#define NET_WAIT_CCOUNT_MAX_MS 20000
+
+static void record_net_wait(uint32_t start, TickType_t start_ticks)
+{
+    const uint32_t ms = (xTaskGetTickCount() - start_ticks)
+        * portTICK_PERIOD_MS;
+    if (ms < NET_WAIT_CCOUNT_MAX_MS) {
+        perf_record(PERF_NET_WAIT, start);
+    } else {
+        perf_record_us(PERF_NET_WAIT,
+            (ms < UINT32_MAX / 1000) ? ms * 1000 : UINT32_MAX);
+    }
+}
+
 bool recvall(int s, uint8_t *buf, size_t size)
 {
+    const uint32_t start = perf_start();
+    const TickType_t start_ticks = xTaskGetTickCount();
+
     int i = 0;
     while (i < size) {
         int bytes_left = size - i;
 
         int recvd = lwip_recv(s, buf + i, bytes_left, 0);
         if (recvd <= 0) {
+            record_net_wait(start, start_ticks);
             return false;
         }
 
         i += recvd;
+        perf_count(PERF_BYTES_RECEIVED, recvd);
     }
 
+    record_net_wait(start, start_ticks);
     return true;
 }
 
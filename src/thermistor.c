@@ -0,0 +1,45 @@
+#include "espressif/esp_system.h"
+#include "thermistor.h"
+
+
+// ADC readings at TABLE_MIN_C and every TABLE_STEP_C above, falling as the
+// thermistor warms. the divider's 320k is in parallel with the thermistor.
+#define TABLE_MIN_C -10
+#define TABLE_STEP_C 5
+static const uint16_t adc_at_temp[] = {
+    878, 839, 795, 745, 692, 635, 577, 520, 464, 411, 362, 317, 277,
+};
+#define TABLE_SIZE (sizeof(adc_at_temp) / sizeof(adc_at_temp[0]))
+
+// readings past these are a thermistor that isn't there, or a short
+#define ADC_OPEN 1000
+#define ADC_SHORTED 20
+
+
+bool thermistor_read_temp(void *arg, int *temp_c)
+{
+    const int adc = sdk_system_adc_read();
+    if (adc > ADC_OPEN || adc < ADC_SHORTED) {
+        return false;
+    }
+
+    // off the ends of the table, the nearest end does
+    if (adc >= adc_at_temp[0]) {
+        *temp_c = TABLE_MIN_C;
+        return true;
+    }
+
+    for (int i = 1; i < TABLE_SIZE; ++i) {
+        if (adc >= adc_at_temp[i]) {
+            // straight between the points either side
+            const int above = adc_at_temp[i - 1];
+            const int below = adc_at_temp[i];
+            *temp_c = TABLE_MIN_C + (i - 1) * TABLE_STEP_C
+                + (above - adc) * TABLE_STEP_C / (above - below);
+            return true;
+        }
+    }
+
+    *temp_c = TABLE_MIN_C + (TABLE_SIZE - 1) * TABLE_STEP_C;
+    return true;
+}
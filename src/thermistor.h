@@ -0,0 +1,24 @@
+#ifndef __THERMISTOR_H__
+#define __THERMISTOR_H__
+
+
+// the panel's temperature, from a thermistor taped to it: a 10k NTC with a
+// B of 3950, from A0 to ground, with a 10k resistor from 3.3V to A0. A0 is
+// read through the Wemos D1 mini's 220k/100k divider onto the ADC.
+
+
+#include <stdbool.h>
+
+
+// whether the board has one. set in the Makefile.
+#ifndef THERMISTOR
+#define THERMISTOR 0
+#endif
+
+
+// eink_temp_cb_t that reads the thermistor. fails if it looks disconnected
+// or shorted. arg is unused.
+bool thermistor_read_temp(void *arg, int *temp_c);
+
+
+#endif
@@ -1,4 +1,8 @@
+#include <limits.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
+#include "crc32.h"
 #include "waveform.h"
 
 
@@ -22,6 +26,8 @@ struct waveform_stage {
     uint32_t ckv_high_delay;
     uint32_t ckv_low_delay;
     enum PIXEL_VALUE values[NUM_WAVEFORMS];
+    enum STAGE_KIND kind;
+    int grey_bit;
 };
 
 static const struct waveform_stage refresh_waveforms[] = {
@@ -34,6 +40,8 @@ static const struct waveform_stage refresh_waveforms[] = {
     {  0, 0, {} },
 };
 
+#if PIXEL_BIT_SIZE == 1
+
 static const struct waveform_stage update_waveforms[] = {
 //      (ns)   (ns)      W->W        W->B        B->W        B->B
     {  60*20, 60*40, { PV_BLACK,   PV_HIZ,     PV_HIZ,     PV_WHITE,   } },
@@ -45,55 +53,363 @@ static const struct waveform_stage update_waveforms[] = {
     {  0, 0, {} },
 };
 
+#else
+
+// greyscale: the W->W and B->W parts of the monochrome waveform take every
+// pixel to a clean white, then one stage per bit of the new grey level
+// darkens it, each half as long as the one before
+static const struct waveform_stage update_waveforms[] = {
+//      (ns)   (ns)      W->W        W->B        B->W        B->B
+    {  60*20, 60*40, { PV_BLACK,   PV_BLACK,   PV_HIZ,     PV_HIZ,     } },
+    {  60*40, 60*40, { PV_BLACK,   PV_BLACK,   PV_WHITE,   PV_WHITE,   } },
+    {  60*60, 60*40, { PV_WHITE,   PV_WHITE,   PV_BLACK,   PV_BLACK,   } },
+    {  60*20, 60*40, { PV_HIZ,     PV_HIZ,     PV_WHITE,   PV_WHITE,   } },
+
+#if PIXEL_BIT_SIZE == 4
+    {  60*80, 60*40, {}, SK_GREY_BIT, 3 },
+    {  60*40, 60*40, {}, SK_GREY_BIT, 2 },
+#endif
+    {  60*20, 60*40, {}, SK_GREY_BIT, PIXEL_BIT_SIZE - 1 },
+    {  60*10, 60*40, {}, SK_GREY_BIT, PIXEL_BIT_SIZE - 2 },
+
+    // null stage to signify end of waveform
+    {  0, 0, {} },
+};
+
+#endif
+
+// fast: two short stages instead of four long ones, driving only the pixels
+// that change, so there's no flash and W->W or B->B costs nothing. grey
+// levels come out as the nearer of black and white.
+static const struct waveform_stage fast_waveforms[] = {
+//      (ns)   (ns)
+    {  60*40, 60*40, {}, SK_CHANGED },
+    {  60*20, 60*40, {}, SK_CHANGED },
+
+    // null stage to signify end of waveform
+    {  0, 0, {} },
+};
+
+struct waveform {
+    const struct waveform_stage *stages;
+    // including the null stage
+    int num_stages;
+};
+
+// where each waveform is in a set of them, and in a waveform file
+#define REFRESH_WAVEFORM 0
+#define UPDATE_WAVEFORM(mode) (1 + (mode))
+
+// partial updates use the full waveform's stages, holding pixels that
+// don't change at PV_NEUTRAL
+static const struct waveform builtin_waveforms[WAVEFORM_FILE_SETS] = {
+    [REFRESH_WAVEFORM] = { refresh_waveforms, COUNT_OF(refresh_waveforms) },
+    [UPDATE_WAVEFORM(EINK_MODE_FULL)] =
+        { update_waveforms, COUNT_OF(update_waveforms) },
+    [UPDATE_WAVEFORM(EINK_MODE_FAST)] =
+        { fast_waveforms, COUNT_OF(fast_waveforms) },
+    [UPDATE_WAVEFORM(EINK_MODE_PARTIAL)] =
+        { update_waveforms, COUNT_OF(update_waveforms) },
+};
+
+// the stages of a waveform file in use, each waveform's followed by a null
+// stage
+static struct waveform_stage
+    loaded_stages[WAVEFORM_FILE_SETS][WAVEFORM_MAX_STAGES + 1];
+static struct waveform loaded_waveforms[WAVEFORM_FILE_SETS];
+static uint32_t loaded_crc;
+
+// builtin_waveforms or loaded_waveforms
+static const struct waveform *waveforms = builtin_waveforms;
+
+
+// the stage timings above are for the coldest band. warmer bands drive each
+// row for a smaller share of its CKV high time; the low time only spaces
+// rows out, so it stays.
+// the band edges and percentages below are placeholders, not measurements:
+// even steps picked to exercise the mechanism. none of them come from the
+// panel's datasheet, and only the cold band, the timings this driver has
+// always used, is known to give clean transitions. measure the others on a
+// panel before relying on a THERMISTOR build.
+struct temp_band {
+    // the lowest temperature in the band, in degrees C
+    int min_temp_c;
+    int ckv_high_percent;
+};
+
+static const struct temp_band temp_bands[NUM_TEMP_BANDS] = {
+    [TEMP_BAND_COLD] = { INT_MIN, 100 },
+    [TEMP_BAND_COOL] = { 10, 85 },
+    [TEMP_BAND_ROOM] = { 18, 70 },
+    [TEMP_BAND_WARM] = { 26, 60 },
+};
+
+enum TEMP_BAND get_temp_band(int temp_c)
+{
+    enum TEMP_BAND band = TEMP_BAND_COLD;
+    for (int i = 1; i < NUM_TEMP_BANDS; ++i) {
+        if (temp_c >= temp_bands[i].min_temp_c) {
+            band = i;
+        }
+    }
+    return band;
+}
+
+// a stage's timings, scaled for band
+static void get_stage_timings(const struct waveform_stage *wstage,
+    enum TEMP_BAND band,
+    uint32_t *ckv_high_delay_ns, uint32_t *ckv_low_delay_ns)
+{
+    if (band < 0 || band >= NUM_TEMP_BANDS) {
+        band = TEMP_BAND_COLD;
+    }
+    *ckv_high_delay_ns = wstage->ckv_high_delay
+        * temp_bands[band].ckv_high_percent / 100;
+    *ckv_low_delay_ns = wstage->ckv_low_delay;
+}
+
+
+// whether a grey level is nearer to black than to white
+static inline bool is_dark(pixel_t pixel)
+{
+    return pixel >= NUM_GREY_LEVELS / 2;
+}
 
-void get_refresh_waveform_timings(int stage,
+
+void get_refresh_waveform_timings(enum TEMP_BAND band, int stage,
     uint32_t *ckv_high_delay_ns, uint32_t *ckv_low_delay_ns)
 {
-    if (stage < 0 || stage >= COUNT_OF(refresh_waveforms)) {
+    const struct waveform *wf = &waveforms[REFRESH_WAVEFORM];
+    if (stage < 0 || stage >= wf->num_stages) {
         *ckv_high_delay_ns = 0;
         *ckv_low_delay_ns = 0;
         return;
     }
 
-    const struct waveform_stage *wstage = &refresh_waveforms[stage];
-    *ckv_high_delay_ns = wstage->ckv_high_delay;
-    *ckv_low_delay_ns = wstage->ckv_low_delay;
+    get_stage_timings(&wf->stages[stage], band,
+        ckv_high_delay_ns, ckv_low_delay_ns);
 }
 
 enum PIXEL_VALUE get_refresh_waveform_value(int stage, pixel_t pixel)
 {
-    const struct waveform_stage *wstage = &refresh_waveforms[stage];
+    const struct waveform_stage *wstage =
+        &waveforms[REFRESH_WAVEFORM].stages[stage];
 
     enum WAVEFORM wf_idx =
-        (pixel == WHITE) ? WF_B2W : WF_W2B;
+        is_dark(pixel) ? WF_W2B : WF_B2W;
 
     return wstage->values[wf_idx];
 }
 
 
-void get_update_waveform_timings(int stage,
-    uint32_t *ckv_high_delay_ns, uint32_t *ckv_low_delay_ns)
+void get_update_waveform_timings(enum EINK_MODE mode, enum TEMP_BAND band,
+    int stage, uint32_t *ckv_high_delay_ns, uint32_t *ckv_low_delay_ns)
 {
-    if (stage < 0 || stage >= COUNT_OF(update_waveforms)) {
+    const struct waveform *wf = &waveforms[UPDATE_WAVEFORM(mode)];
+    if (stage < 0 || stage >= wf->num_stages) {
         *ckv_high_delay_ns = 0;
         *ckv_low_delay_ns = 0;
         return;
     }
 
-    const struct waveform_stage *wstage = &update_waveforms[stage];
-    *ckv_high_delay_ns = wstage->ckv_high_delay;
-    *ckv_low_delay_ns = wstage->ckv_low_delay;
+    get_stage_timings(&wf->stages[stage], band,
+        ckv_high_delay_ns, ckv_low_delay_ns);
 }
 
-enum PIXEL_VALUE get_update_waveform_value(int stage,
+enum PIXEL_VALUE get_update_waveform_value(enum EINK_MODE mode, int stage,
     pixel_t old_pixel, pixel_t new_pixel)
 {
+    const struct waveform_stage *wstage =
+        &waveforms[UPDATE_WAVEFORM(mode)].stages[stage];
+
+    if (EINK_MODE_PARTIAL == mode && old_pixel == new_pixel) {
+        return PV_NEUTRAL;
+    }
+
+    if (SK_GREY_BIT == wstage->kind) {
+        return ((new_pixel >> wstage->grey_bit) & 1) ? PV_BLACK : PV_NEUTRAL;
+    }
+
+    if (SK_CHANGED == wstage->kind) {
+        if (old_pixel == new_pixel) {
+            return PV_NEUTRAL;
+        }
+        return is_dark(new_pixel) ? PV_BLACK : PV_WHITE;
+    }
+
+    const bool old_dark = is_dark(old_pixel);
+    const bool new_dark = is_dark(new_pixel);
     enum WAVEFORM wf_idx =
-        (old_pixel == WHITE && new_pixel == WHITE) ? WF_W2W
-        : (old_pixel == BLACK && new_pixel == WHITE) ? WF_B2W
-        : (old_pixel == WHITE && new_pixel == BLACK) ? WF_W2B
+        (!old_dark && !new_dark) ? WF_W2W
+        : (old_dark && !new_dark) ? WF_B2W
+        : (!old_dark && new_dark) ? WF_W2B
         : WF_B2B;
 
-    const struct waveform_stage *wstage = &update_waveforms[stage];
     return wstage->values[wf_idx];
 }
+
+
+// the file's crc field is the CRC of the header before it and the stages
+static uint32_t file_crc(const void *data, size_t size)
+{
+    const size_t crc_ofs = offsetof(struct waveform_file_header, crc);
+    const size_t header_size = sizeof(struct waveform_file_header);
+    const uint8_t *p = data;
+
+    const uint32_t crc = crc32_update(0, p, crc_ofs);
+    return crc32_update(crc, p + header_size, size - header_size);
+}
+
+size_t waveform_file_size(const struct waveform_file_header *hdr)
+{
+    if (WAVEFORM_MAGIC != hdr->magic || WAVEFORM_VERSION != hdr->version
+        || PIXEL_BIT_SIZE != hdr->pixel_bit_size)
+    {
+        return 0;
+    }
+
+    int num_stages = 0;
+    int num_update_stages = 0;
+    for (int i = 0; i < WAVEFORM_FILE_SETS; ++i) {
+        const int n = hdr->num_stages[i];
+        if (n < 1 || n > WAVEFORM_MAX_STAGES) {
+            return 0;
+        }
+        num_stages += n;
+        if (REFRESH_WAVEFORM != i) {
+            num_update_stages += n;
+        }
+    }
+    if (num_update_stages > WAVEFORM_MAX_UPDATE_STAGES) {
+        return 0;
+    }
+
+    return sizeof(*hdr) + num_stages * sizeof(struct waveform_file_stage);
+}
+
+// whether the driver can run a file's stage of waveform set
+static bool is_usable_stage(int set, const struct waveform_file_stage *fs)
+{
+    // a 0 high time would end the waveform there
+    if (0 == fs->ckv_high_ns || fs->kind >= NUM_STAGE_KINDS) {
+        return false;
+    }
+    // refreshes don't know old and new levels, only the level to clear to
+    if (REFRESH_WAVEFORM == set && SK_TRANSITION != fs->kind) {
+        return false;
+    }
+    return SK_GREY_BIT != fs->kind || fs->grey_bit < PIXEL_BIT_SIZE;
+}
+
+bool waveform_file_check(const void *data, size_t size)
+{
+    struct waveform_file_header hdr;
+    if (size < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+
+    if (size != waveform_file_size(&hdr) || hdr.crc != file_crc(data, size)) {
+        return false;
+    }
+
+    // the stages aren't necessarily aligned
+    const uint8_t *p = (const uint8_t *)data + sizeof(hdr);
+    for (int set = 0; set < WAVEFORM_FILE_SETS; ++set) {
+        for (int i = 0; i < hdr.num_stages[set]; ++i) {
+            struct waveform_file_stage fs;
+            memcpy(&fs, p, sizeof(fs));
+            p += sizeof(fs);
+
+            if (!is_usable_stage(set, &fs)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void waveform_use_file(const void *data)
+{
+    if (!data) {
+        waveforms = builtin_waveforms;
+        loaded_crc = 0;
+        return;
+    }
+
+    struct waveform_file_header hdr;
+    memcpy(&hdr, data, sizeof(hdr));
+    loaded_crc = hdr.crc;
+
+    const uint8_t *p = (const uint8_t *)data + sizeof(hdr);
+    for (int set = 0; set < WAVEFORM_FILE_SETS; ++set) {
+        const int n = hdr.num_stages[set];
+        struct waveform_stage *stages = loaded_stages[set];
+
+        for (int i = 0; i < n; ++i) {
+            struct waveform_file_stage fs;
+            memcpy(&fs, p, sizeof(fs));
+            p += sizeof(fs);
+
+            stages[i] = (struct waveform_stage){
+                .ckv_high_delay = fs.ckv_high_ns,
+                .ckv_low_delay = fs.ckv_low_ns,
+                .kind = fs.kind,
+                .grey_bit = fs.grey_bit,
+            };
+            for (int wf = 0; wf < NUM_WAVEFORMS; ++wf) {
+                stages[i].values[wf] = (fs.values >> (6 - 2 * wf)) & 3;
+            }
+        }
+        stages[n] = (struct waveform_stage){};
+
+        loaded_waveforms[set] = (struct waveform){ stages, n + 1 };
+    }
+
+    waveforms = loaded_waveforms;
+}
+
+uint32_t waveform_file_crc(void)
+{
+    return loaded_crc;
+}
+
+size_t waveform_save_file(void *buf)
+{
+    struct waveform_file_header hdr = {
+        .magic = WAVEFORM_MAGIC,
+        .version = WAVEFORM_VERSION,
+        .pixel_bit_size = PIXEL_BIT_SIZE,
+    };
+
+    uint8_t *p = (uint8_t *)buf + sizeof(hdr);
+    for (int set = 0; set < WAVEFORM_FILE_SETS; ++set) {
+        const struct waveform *wf = &waveforms[set];
+
+        // up to the null stage
+        for (int i = 0; i < wf->num_stages
+            && 0 != wf->stages[i].ckv_high_delay; ++i)
+        {
+            const struct waveform_stage *ws = &wf->stages[i];
+            struct waveform_file_stage fs = {
+                .ckv_high_ns = ws->ckv_high_delay,
+                .ckv_low_ns = ws->ckv_low_delay,
+                .kind = ws->kind,
+                .grey_bit = ws->grey_bit,
+            };
+            for (int v = 0; v < NUM_WAVEFORMS; ++v) {
+                fs.values |= (ws->values[v] & 3) << (6 - 2 * v);
+            }
+
+            memcpy(p, &fs, sizeof(fs));
+            p += sizeof(fs);
+            ++hdr.num_stages[set];
+        }
+    }
+
+    const size_t size = p - (uint8_t *)buf;
+    memcpy(buf, &hdr, sizeof(hdr));
+    hdr.crc = file_crc(buf, size);
+    memcpy(buf, &hdr, sizeof(hdr));
+    return size;
+}
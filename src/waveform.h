@@ -7,6 +7,7 @@ extern "C" {
 #endif
 
 
+#include <stddef.h>
 #include "eink.h"
 
 
@@ -17,27 +18,125 @@ enum PIXEL_VALUE {
     PV_HIZ,
 };
 
+// how a stage picks each pixel's value
+enum STAGE_KIND {
+    // from values[], by the transition between the old and new pixels'
+    // nearest black or white
+    SK_TRANSITION = 0,
+    // PV_BLACK for pixels whose new grey level has bit grey_bit set,
+    // PV_NEUTRAL for the rest
+    SK_GREY_BIT,
+    // PV_BLACK or PV_WHITE for pixels whose grey level changes, by the new
+    // level's nearest, PV_NEUTRAL for the rest
+    SK_CHANGED,
+    NUM_STAGE_KINDS,
+};
+
+// most stages any one waveform can have, and all the update waveforms
+// together
+#define WAVEFORM_MAX_STAGES 8
+#define WAVEFORM_MAX_UPDATE_STAGES (2 * WAVEFORM_MAX_STAGES + 2)
+
+
+// the panel's particles move more slowly the colder it is, so each band of
+// temperatures has its own timings, the coldest the longest. the coldest is
+// also for when the temperature isn't known.
+enum TEMP_BAND {
+    TEMP_BAND_COLD = 0,
+    TEMP_BAND_COOL,
+    TEMP_BAND_ROOM,
+    TEMP_BAND_WARM,
+    NUM_TEMP_BANDS,
+};
+
+// the band a panel temperature in degrees C falls in
+enum TEMP_BAND get_temp_band(int temp_c);
 
-// get refresh waveform timings in nanoseconds at given stage. sets delays to
-// 0 if there is no such stage.
-void get_refresh_waveform_timings(int stage,
+
+// get refresh waveform timings in nanoseconds at given stage, for a panel in
+// band. sets delays to 0 if there is no such stage.
+void get_refresh_waveform_timings(enum TEMP_BAND band, int stage,
     uint32_t *ckv_high_delay_ns, uint32_t *ckv_low_delay_ns);
 
 // get value at given stage of refresh waveform that clears everything to the
-// given pixel.
+// given pixel. grey levels clear to the nearer of black and white.
 enum PIXEL_VALUE get_refresh_waveform_value(int stage, pixel_t pixel);
 
 
-// like get_refresh_waveform_timings, but for update waveforms
-void get_update_waveform_timings(int stage,
+// like get_refresh_waveform_timings, but for mode's update waveform
+void get_update_waveform_timings(enum EINK_MODE mode, enum TEMP_BAND band,
+    int stage,
     uint32_t *ckv_high_delay_ns, uint32_t *ckv_low_delay_ns);
 
-// get value at given stage of update waveform that changes an old_p pixel
-// to new_p.
-enum PIXEL_VALUE get_update_waveform_value(int stage,
+// get value at given stage of mode's update waveform that changes an old_p
+// pixel to new_p, for any pair of grey levels.
+enum PIXEL_VALUE get_update_waveform_value(enum EINK_MODE mode, int stage,
     pixel_t old_pixel, pixel_t new_pixel);
 
 
+// waveforms can be loaded at run time from a file, in flash or sent with
+// PROTO_CMD_WAVEFORM, so timings can be tuned without a rebuild. a file is a
+// struct waveform_file_header, then the stages of the refresh waveform and
+// of each EINK_MODE's update waveform, in that order, one after the other.
+// like the wire protocol, it's little endian.
+
+// "EWFM"
+#define WAVEFORM_MAGIC 0x4d465745
+#define WAVEFORM_VERSION 1
+
+// the refresh waveform, then an update waveform for each mode
+#define WAVEFORM_FILE_SETS (1 + NUM_EINK_MODES)
+
+struct waveform_file_header {
+    uint32_t magic;
+    uint8_t version;
+    // the PIXEL_BIT_SIZE it's for, which SK_GREY_BIT stages depend on
+    uint8_t pixel_bit_size;
+    // stages of each waveform, 1 to WAVEFORM_MAX_STAGES
+    uint8_t num_stages[WAVEFORM_FILE_SETS];
+    uint8_t reserved[2];
+    // crc32_update() of the header up to here, then of the stages
+    uint32_t crc;
+};
+
+struct waveform_file_stage {
+    // for the coldest temperature band
+    uint16_t ckv_high_ns;
+    uint16_t ckv_low_ns;
+    // an enum STAGE_KIND
+    uint8_t kind;
+    uint8_t grey_bit;
+    // the enum PIXEL_VALUEs for W->W, W->B, B->W and B->B, 2 bits each,
+    // W->W in the top bits
+    uint8_t values;
+    uint8_t reserved;
+};
+
+#define WAVEFORM_FILE_MAX_SIZE (sizeof(struct waveform_file_header) \
+    + WAVEFORM_FILE_SETS * WAVEFORM_MAX_STAGES \
+        * sizeof(struct waveform_file_stage))
+
+// the size of the file starting with hdr, or 0 if hdr isn't one this build
+// can use
+size_t waveform_file_size(const struct waveform_file_header *hdr);
+
+// whether size bytes are a whole waveform file with a good CRC, and stages
+// this build can use
+bool waveform_file_check(const void *data, size_t size);
+
+// switches to the waveforms of a file that passed waveform_file_check, or
+// back to the built in ones if data is NULL. the driver has to rebuild its
+// tables afterwards, so only use this through eink_load_waveforms.
+void waveform_use_file(const void *data);
+
+// the crc field of the file in use, or 0 for the built in waveforms
+uint32_t waveform_file_crc(void);
+
+// writes the waveforms in use as a file into buf, which must have room for
+// WAVEFORM_FILE_MAX_SIZE bytes. returns its size.
+size_t waveform_save_file(void *buf);
+
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
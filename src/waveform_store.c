@@ -0,0 +1,50 @@
+#include <string.h>
+#include "espressif/spi_flash.h"
+#include "waveform.h"
+#include "waveform_store.h"
+
+
+#define FLASH_ADDR (WAVEFORM_FLASH_SECTOR * SPI_FLASH_SEC_SIZE)
+
+// flash is read and written a word at a time, from word aligned buffers
+#define WORDS(size) (((size) + 3) / 4)
+static uint32_t file_words[WORDS(WAVEFORM_FILE_MAX_SIZE)];
+
+
+const void *waveform_store_read(size_t *size)
+{
+    struct waveform_file_header hdr;
+    if (SPI_FLASH_RESULT_OK != sdk_spi_flash_read(FLASH_ADDR, file_words,
+        4 * WORDS(sizeof(hdr))))
+    {
+        return NULL;
+    }
+    memcpy(&hdr, file_words, sizeof(hdr));
+
+    // an erased sector reads as all 1s, which isn't a header
+    *size = waveform_file_size(&hdr);
+    if (0 == *size || SPI_FLASH_RESULT_OK != sdk_spi_flash_read(FLASH_ADDR,
+        file_words, 4 * WORDS(*size)))
+    {
+        return NULL;
+    }
+    return file_words;
+}
+
+bool waveform_store_write(const void *data, size_t size)
+{
+    if (size > sizeof(file_words)) {
+        return false;
+    }
+
+    memset(file_words, 0xff, sizeof(file_words));
+    memcpy(file_words, data, size);
+
+    if (SPI_FLASH_RESULT_OK != sdk_spi_flash_erase_sector(
+        WAVEFORM_FLASH_SECTOR))
+    {
+        return false;
+    }
+    return 0 == size || SPI_FLASH_RESULT_OK == sdk_spi_flash_write(
+        FLASH_ADDR, file_words, 4 * WORDS(size));
+}
@@ -0,0 +1,29 @@
+#ifndef __WAVEFORM_STORE_H__
+#define __WAVEFORM_STORE_H__
+
+
+// a waveform file kept in a sector of flash, so it survives restarts. a
+// write that's cut off leaves a file that fails its CRC, which gets the
+// built in waveforms used instead.
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// clear of the firmware, and of the SDK's settings at the end of flash
+#ifndef WAVEFORM_FLASH_SECTOR
+#define WAVEFORM_FLASH_SECTOR 0x100
+#endif
+
+
+// the stored file, or NULL if there's none. its size is set from its header;
+// it's up to the caller to check the rest. it stays put until the next call.
+const void *waveform_store_read(size_t *size);
+
+// stores a waveform file of size bytes, or with size 0 erases the stored
+// one. returns false if flash fails.
+bool waveform_store_write(const void *data, size_t size);
+
+
+#endif